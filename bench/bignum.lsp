@@ -0,0 +1,17 @@
+; Big integers: 5000 factorial, which grows past a machine word early
+; on and ends up over 16000 digits; squaring it, which is big enough
+; for Karatsuba's method; and summing 100k numbers too big for a word,
+; against as many that fit in one.
+
+(defn {fact n acc} { if (== n 0) {acc} {fact (dec n) (* acc n)} })
+
+(bench "5000 factorial" 10 (fn {_} {fact 5000 1}))
+
+(def {fact5000} (fact 5000 1))
+(bench "5000 factorial squared" 10 (fn {_} {* fact5000 fact5000}))
+
+(def {bigs} (fill 100000 (fn {i} {* i 100000000000000000000})))
+(bench "sum of 100k big numbers" 10 (fn {_} {sum bigs}))
+
+(def {smalls} (iota 100000))
+(bench "sum of 100k small numbers" 10 (fn {_} {sum smalls}))
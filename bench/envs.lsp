@@ -0,0 +1,87 @@
+; Environment lookups against environment size. Each call binds n
+; arguments in a fresh frame, which looks each name up to see it isn't
+; already there, then calls a function that looks the last of them up
+; n/2 times, through its own frame to the caller's. The caller binds
+; them in one order, then in the other, so that where a name was last
+; found is no help and every lookup searches the frames; cache-stats,
+; which counts from the start, shows the misses. Each size binds 160k
+; names and looks up 80k in all, so the totals compare directly:
+; frames of more than a few names are hashed, so they shouldn't grow
+; with n.
+
+(defn {look8 _} {
+  + a8 a8 a8 a8
+})
+
+(defn {bind8
+    a1 a2 a3 a4 a5 a6 a7 a8} {
+  look8 0
+})
+
+(defn {bind8-rev
+    a8 a7 a6 a5 a4 a3 a2 a1} {
+  look8 0
+})
+
+(defn {look32 _} {
+  + a32 a32 a32 a32 a32 a32 a32 a32 a32 a32 a32 a32
+    a32 a32 a32 a32
+})
+
+(defn {bind32
+    a1 a2 a3 a4 a5 a6 a7 a8 a9 a10 a11 a12 a13 a14 a15 a16 a17 a18 a19
+    a20 a21 a22 a23 a24 a25 a26 a27 a28 a29 a30 a31 a32} {
+  look32 0
+})
+
+(defn {bind32-rev
+    a32 a31 a30 a29 a28 a27 a26 a25 a24 a23 a22 a21 a20 a19 a18 a17
+    a16 a15 a14 a13 a12 a11 a10 a9 a8 a7 a6 a5 a4 a3 a2 a1} {
+  look32 0
+})
+
+(defn {look128 _} {
+  + a128 a128 a128 a128 a128 a128 a128 a128 a128 a128 a128 a128
+    a128 a128 a128 a128 a128 a128 a128 a128 a128 a128 a128 a128
+    a128 a128 a128 a128 a128 a128 a128 a128 a128 a128 a128 a128
+    a128 a128 a128 a128 a128 a128 a128 a128 a128 a128 a128 a128
+    a128 a128 a128 a128 a128 a128 a128 a128 a128 a128 a128 a128
+    a128 a128 a128 a128
+})
+
+(defn {bind128
+    a1 a2 a3 a4 a5 a6 a7 a8 a9 a10 a11 a12 a13 a14 a15 a16 a17 a18 a19
+    a20 a21 a22 a23 a24 a25 a26 a27 a28 a29 a30 a31 a32 a33 a34 a35
+    a36 a37 a38 a39 a40 a41 a42 a43 a44 a45 a46 a47 a48 a49 a50 a51
+    a52 a53 a54 a55 a56 a57 a58 a59 a60 a61 a62 a63 a64 a65 a66 a67
+    a68 a69 a70 a71 a72 a73 a74 a75 a76 a77 a78 a79 a80 a81 a82 a83
+    a84 a85 a86 a87 a88 a89 a90 a91 a92 a93 a94 a95 a96 a97 a98 a99
+    a100 a101 a102 a103 a104 a105 a106 a107 a108 a109 a110 a111 a112
+    a113 a114 a115 a116 a117 a118 a119 a120 a121 a122 a123 a124 a125
+    a126 a127 a128} {
+  look128 0
+})
+
+(defn {bind128-rev
+    a128 a127 a126 a125 a124 a123 a122 a121 a120 a119 a118 a117 a116
+    a115 a114 a113 a112 a111 a110 a109 a108 a107 a106 a105 a104 a103
+    a102 a101 a100 a99 a98 a97 a96 a95 a94 a93 a92 a91 a90 a89 a88 a87
+    a86 a85 a84 a83 a82 a81 a80 a79 a78 a77 a76 a75 a74 a73 a72 a71
+    a70 a69 a68 a67 a66 a65 a64 a63 a62 a61 a60 a59 a58 a57 a56 a55
+    a54 a53 a52 a51 a50 a49 a48 a47 a46 a45 a44 a43 a42 a41 a40 a39
+    a38 a37 a36 a35 a34 a33 a32 a31 a30 a29 a28 a27 a26 a25 a24 a23
+    a22 a21 a20 a19 a18 a17 a16 a15 a14 a13 a12 a11 a10 a9 a8 a7 a6 a5
+    a4 a3 a2 a1} {
+  look128 0
+})
+
+(def {args8} (iota 8))
+(def {args32} (iota 32))
+(def {args128} (iota 128))
+
+(bench "8 names" 10000 (fn {_} {+ (apply bind8 args8) (apply bind8-rev args8)}))
+(cache-stats ())
+(bench "32 names" 2500 (fn {_} {+ (apply bind32 args32) (apply bind32-rev args32)}))
+(cache-stats ())
+(bench "128 names" 625 (fn {_} {+ (apply bind128 args128) (apply bind128-rev args128)}))
+(cache-stats ())
@@ -0,0 +1,24 @@
+; Joining 1000 lists of 1000 elements in one join. Cells are added to
+; a list by growing it geometrically, so each case takes time in
+; proportion to the million cells, but how they get there differs:
+;
+; - lists held elsewhere, and slices, have each cell copied and its
+;   element referenced once more;
+; - fresh lists, which reverse makes and nothing else holds, are moved
+;   over with a single memcpy. Making them is timed on its own too, to
+;   take away from the join.
+;
+; The lists are all different, so that none of the cases gets to read
+; the same few cells over and over from the cache.
+;
+; Joining them one at a time with foldl is still quadratic: foldl's
+; frame holds on to the list built so far, so every join copies it.
+
+(def {piece} (iota 1000))
+(def {pieces} (fill 1000 (fn {_} {reverse piece})))
+
+(bench "join 1000 shared lists" 10 (fn {_} {len (eval (cons join pieces))}))
+(bench "join 1000 slices" 10 (fn {_} {len (eval (cons join (map tail pieces)))}))
+(bench "make 1000 fresh lists" 10 (fn {_} {len (eval (cons list (map reverse pieces)))}))
+(bench "make and join 1000 fresh lists" 10 (fn {_} {len (eval (cons join (map reverse pieces)))}))
+(bench "foldl join over 1000 lists" 1 (fn {_} {len (foldl join {} pieces)}))
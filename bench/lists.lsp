@@ -0,0 +1,56 @@
+; List operations on 100k elements: reverse, take, drop, zip and nth
+; as builtins, with take and drop sharing the list's cells rather than
+; copying them. For comparison, the prologue's old recursive versions
+; run on 10k, as much as they manage without running out of C stack;
+; they walk with today's tail, which no longer copies, so they come
+; out faster than they used to.
+
+(defn {old-nth n l} {
+  if (zero? n)
+    {first l}
+    {old-nth (dec n) (tail l)}
+})
+
+(defn {old-take n l} {
+  if (and n (len l))
+    {join (head l) (old-take (dec n) (tail l))}
+    {nil}
+})
+
+(defn {old-drop n l} {
+  if (and n (len l))
+    {old-drop (dec n) (tail l)}
+    {l}
+})
+
+(defn {old-reverse l} {
+  if (empty? l)
+    {nil}
+    {join (old-reverse (tail l)) (head l)}
+})
+
+(defn {old-zip x y} {
+  if (any? empty? {x y})
+    {nil}
+    {join (list (join (head x) (head y))) (old-zip (tail x) (tail y))}
+})
+
+(def {big} (iota 100000))
+(def {small} (iota 10000))
+
+(bench "reverse 100k" 100 (fn {_} {reverse big}))
+(bench "take 50k of 100k" 100 (fn {_} {take 50000 big}))
+(bench "drop 50k of 100k" 100 (fn {_} {drop 50000 big}))
+(bench "zip 100k" 10 (fn {_} {zip big big}))
+(bench "nth 99999 of 100k" 100 (fn {_} {nth 99999 big}))
+
+(bench "reverse 10k" 100 (fn {_} {reverse small}))
+(bench "old reverse 10k" 1 (fn {_} {old-reverse small}))
+(bench "take 5k of 10k" 100 (fn {_} {take 5000 small}))
+(bench "old take 5k of 10k" 1 (fn {_} {old-take 5000 small}))
+(bench "drop 5k of 10k" 100 (fn {_} {drop 5000 small}))
+(bench "old drop 5k of 10k" 1 (fn {_} {old-drop 5000 small}))
+(bench "zip 10k" 100 (fn {_} {zip small small}))
+(bench "old zip 10k" 1 (fn {_} {old-zip small small}))
+(bench "nth 9999 of 10k" 100 (fn {_} {nth 9999 small}))
+(bench "old nth 9999 of 10k" 1 (fn {_} {old-nth 9999 small}))
@@ -0,0 +1,18 @@
+#!/bin/sh
+# Run the benchmarks named (as in bench/lists.lsp, or just lists), or
+# all of them, each in a fresh interpreter. Set LISPY_ARGS to pick an
+# engine, e.g. LISPY_ARGS=--engine=vm. Run from src/, where the
+# interpreter finds its prologue.
+
+LISPY=${LISPY:-./lispy}
+
+[ $# -eq 0 ] && set -- ../bench/*.lsp
+
+for b in "$@"; do
+    name=$(basename "$b" .lsp)
+    [ "$name" = util ] && continue
+
+    echo "== $name"
+    printf 'load "../bench/util.lsp"\nload "../bench/%s.lsp"\n' "$name" |
+        "$LISPY" $LISPY_ARGS 2>&1 | grep -v '^>>\|^=> \|^Ta-ta\|^$'
+done
@@ -0,0 +1,36 @@
+; Helpers for the benchmarks; bench/run.sh loads this first
+
+; {(f 0) (f 1) ... (f (- n 1))}, built a thousand at a time so that map
+; never recurses deeper than that
+(defn {fill n f} { fill-down (- n 1) f nil })
+
+(defn {fill-down hi f acc} {
+  if (< hi 0)
+    {acc}
+    {fill-down (- hi 1000) f
+      (join (map f (range (if (< hi 999) {0} {(- hi 999)}) hi)) acc)}
+})
+
+(defn {iota n} { fill n (fn {i} {i}) })
+
+; Call f on n, n-1, ... 1, for whatever it does
+(defn {times n f} {
+  if (== n 0) {nil} {times-after (f n) n f}
+})
+
+(defn {times-after _ n f} { times (dec n) f })
+
+; Time n calls of f, printing the total and the time per call
+(defn {bench name n f} {
+  bench-done name n (clock ()) (times n f)
+})
+
+(defn {bench-done name n start _} {
+  bench-print name n (- (clock ()) start)
+})
+
+(defn {bench-print name n secs} {
+  print name (to-3 (* secs 1000)) "ms," (to-3 (/ (* secs 1000000) n)) "us each"
+})
+
+(defn {to-3 x} { / (floor (* x 1000)) 1000 })
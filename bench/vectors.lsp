@@ -0,0 +1,20 @@
+; Packed vectors against lists: summing 200k numbers with sum from the
+; prologue, then with vsum on a vector of them, and the other vector
+; builtins on the same. Run with LISPY_SIMD=sse2 or LISPY_SIMD=scalar
+; to compare the kernels.
+
+(def {ints} (iota 200000))
+(def {floats} (vlist (vscale (vec ints) 0.5)))
+(def {vi} (vec ints))
+(def {vf} (vec floats))
+
+(bench "sum of 200k integers" 5 (fn {_} {sum ints}))
+(bench "vsum of 200k integers" 1000 (fn {_} {vsum vi}))
+(bench "sum of 200k floats" 5 (fn {_} {sum floats}))
+(bench "vsum of 200k floats" 1000 (fn {_} {vsum vf}))
+
+(bench "vdot" 1000 (fn {_} {vdot vf vf}))
+(bench "vmap+" 1000 (fn {_} {vmap+ vf vf}))
+(bench "vscale" 1000 (fn {_} {vscale vf 2.0}))
+(bench "vmax" 1000 (fn {_} {vmax vf}))
+(bench "vfilter<" 1000 (fn {_} {vfilter< vi 100000}))
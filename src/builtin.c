@@ -1,4 +1,14 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <time.h>
+
 #include "builtin.h"
+#include "lparse.h"
+#include "lopt.h"
+#include "lbig.h"
+#include "lvec.h"
 
 /* Builtins */
 
@@ -7,10 +17,10 @@ LVAL* builtin_var(LENV* e, LVAL* a, char* func) {
 
     LVAL* syms = a->cell[0];
     for (int i = 0; i < syms->count; i++) {
-        LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
+        LASSERT(a, (ltype(syms->cell[i]) == LVAL_SYM),
                 "Function '%s' cannot define non-symbol. "
                 "Got %s, expected %s.", func,
-                ltype_name(syms->cell[i]->type),
+                ltype_name(ltype(syms->cell[i])),
                 ltype_name(LVAL_SYM));
     }
 
@@ -33,6 +43,74 @@ LVAL* builtin_var(LENV* e, LVAL* a, char* func) {
     return lval_sexpr();
 }
 
+/* Formals of the lambdas enclosing the code being resolved, innermost first */
+typedef struct LSCOPE {
+    LVAL* formals;
+    struct LSCOPE* up;
+} LSCOPE;
+
+/* Slot a formal is bound to, skipping '&', or -1 */
+static int lscope_slot(LVAL* formals, char* sym) {
+    int slot = 0;
+    for (int i = 0; i < formals->count; i++) {
+        if (ltype(formals->cell[i]) != LVAL_SYM) { return -1; }
+        char* f = formals->cell[i]->sym;
+        if (f == lsym_amp) { continue; }
+        if (f == sym) { return slot; }
+        slot++;
+    }
+    return -1;
+}
+
+/* Whether an expression is (-> {formals} body), by whatever global name */
+static int lscope_is_lambda(LENV* g, LVAL* x) {
+    if (x->count != 3 || ltype(x->cell[0]) != LVAL_SYM ||
+        ltype(x->cell[1]) != LVAL_QEXPR) { return 0; }
+
+    LVAL* f = lenv_get(g, x->cell[0]);
+    int is = ltype(f) == LVAL_FUN && f->builtin == builtin_lambda;
+    lval_del(f);
+    return is;
+}
+
+/**
+ * Give symbols in a lambda body the (depth, slot) of the formal they
+ * refer to, looking through lambdas written out inside the body. Only
+ * symbols that resolve are touched; the rest are looked up dynamically.
+ */
+static void lval_resolve(LENV* g, LVAL* x, LSCOPE* s) {
+    switch (ltype(x)) {
+    case LVAL_SYM: {
+        int depth = 0;
+        for (; s; s = s->up, depth++) {
+            int slot = lscope_slot(s->formals, x->sym);
+            if (slot >= 0) {
+                x->depth = depth;
+                x->slot = slot;
+                return;
+            }
+        }
+        break;
+    }
+
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+        if (ltype(x) == LVAL_SEXPR && lscope_is_lambda(g, x)) {
+            lval_resolve(g, x->cell[0], s);
+            if (ltype(x->cell[2]) == LVAL_QEXPR) {
+                LSCOPE inner = { x->cell[1], s };
+                lval_resolve(g, x->cell[2], &inner);
+            } else {
+                lval_resolve(g, x->cell[2], s);
+            }
+            break;
+        }
+
+        for (int i = 0; i < x->count; i++) { lval_resolve(g, x->cell[i], s); }
+        break;
+    }
+}
+
 LVAL* builtin_lambda(LENV* e, LVAL* a) {
     LASSERT_NUM("->", a, 2);
     LASSERT_TYPE("->", a, 0, LVAL_QEXPR);
@@ -40,16 +118,25 @@ LVAL* builtin_lambda(LENV* e, LVAL* a) {
 
     /* First q-expression should contain only symbols */
     for (int i = 0; i < a->cell[0]->count; i++) {
-        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
+        LASSERT(a, (ltype(a->cell[0]->cell[i]) == LVAL_SYM),
                 "Cannot define non-symbol. Got %s, expected %s.",
-                ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+                ltype_name(ltype(a->cell[0]->cell[i])), ltype_name(LVAL_SYM));
     }
 
     LVAL* formals = lval_pop(a, 0);
     LVAL* body = lval_pop(a, 0);
     lval_del(a);
 
-    return lval_lambda(formals, body);
+    /* Nested lambdas are spotted by the global binding of their head */
+    LENV* g = e;
+    while (g->parent) { g = g->parent; }
+
+    LSCOPE scope = { formals, NULL };
+    lval_resolve(g, body, &scope);
+
+    LVAL* f = lval_lambda(formals, body);
+    f->opt = lopt_fold(g, formals, body);
+    return f;
 }
 
 LVAL* builtin_def(LENV* e, LVAL* a) {
@@ -60,16 +147,22 @@ LVAL* builtin_put(LENV* e, LVAL* a) {
     return builtin_var(e, a, "=");
 }
 
-LVAL* builtin_eval(LENV *e, LVAL* a) {
+/* The expression eval evaluates, or an error */
+LVAL* builtin_eval_expr(LENV *e, LVAL* a) {
     LASSERT_NUM("eval", a, 1);
     LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
 
-    LVAL* x = lval_take(a, 0);
+    LVAL* x = lval_own(lval_take(a, 0));
     x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+    return x;
+}
+
+LVAL* builtin_eval(LENV *e, LVAL* a) {
+    return lval_eval(e, builtin_eval_expr(e, a));
 }
 
 LVAL* builtin_list(LENV *e, LVAL* a) {
+    a = lval_own(a);
     a->type = LVAL_QEXPR;
     return a;
 }
@@ -89,8 +182,9 @@ LVAL* builtin_head(LENV *e, LVAL* a) {
     LASSERT_NOT_EMPTY("head", a, 0);
 
     LVAL* v = lval_take(a, 0);
-    while (v->count > 1) { lval_del(lval_pop(v, 1)); }
-    return v;
+    LVAL* x = lval_add(lval_qexpr(), lval_ref(v->cell[0]));
+    lval_del(v);
+    return x;
 }
 
 LVAL* builtin_tail(LENV *e, LVAL* a) {
@@ -99,8 +193,7 @@ LVAL* builtin_tail(LENV *e, LVAL* a) {
     LASSERT_NOT_EMPTY("tail", a, 0);
 
     LVAL* v = lval_take(a, 0);
-    lval_del(lval_pop(v, 0));
-    return v;
+    return lval_slice(v, 1, v->count - 1);
 }
 
 LVAL* builtin_join(LENV *e, LVAL* a) {
@@ -118,159 +211,724 @@ LVAL* builtin_join(LENV *e, LVAL* a) {
     return x;
 }
 
+/* A qexpr of count cells, for the caller to fill in */
+static LVAL* list_of(int count) {
+    LVAL* x = lval_qexpr();
+    lval_reserve(x, count);
+    x->count = count;
+    return x;
+}
+
 LVAL* builtin_cons(LENV *e, LVAL *a) {
     LASSERT_NUM("cons", a, 2);
     LASSERT_TYPE("cons", a, 1, LVAL_QEXPR);
 
-    LVAL* x = lval_qexpr();
+    LVAL* l = a->cell[1];
+    LVAL* x = list_of(l->count + 1);
 
-    x = lval_add(x, lval_pop(a, 0));
-    x = lval_join(x, lval_pop(a, 0));
+    x->cell[0] = lval_pop(a, 0);
+    for (int i = 0; i < l->count; i++) {
+        x->cell[i+1] = lval_ref(l->cell[i]);
+    }
 
     lval_del(a);
     return x;
 }
 
-LVAL* builtin_op(LVAL* a, char* op) {
-    /* Ensure all arguments are numbers */
-    for (int i = 0; i < a->count; i++) {
-        LASSERT_TYPE(op, a, i, LVAL_NUM);
+/* The i-th element, evaluated like first does */
+static LVAL* list_elem(LENV* e, LVAL* a, int i) {
+    LVAL* x = lval_add(lval_qexpr(), lval_ref(a->cell[0]->cell[i]));
+    lval_del(a);
+    return builtin_eval(e, lval_add(lval_sexpr(), x));
+}
+
+LVAL* builtin_nth(LENV *e, LVAL* a) {
+    LASSERT_NUM("nth", a, 2);
+    LASSERT_TYPE("nth", a, 0, LVAL_NUM);
+    LASSERT_TYPE("nth", a, 1, LVAL_QEXPR);
+
+    long i = lnum(a->cell[0]);
+    int count = a->cell[1]->count;
+    LASSERT(a, i >= 0 && i < count,
+            "Function 'nth' passed index %li, out of range for a list of %i.",
+            i, count);
+
+    lval_del(lval_pop(a, 0));
+    return list_elem(e, a, i);
+}
+
+LVAL* builtin_last(LENV *e, LVAL* a) {
+    LASSERT_NUM("last", a, 1);
+    LASSERT_TYPE("last", a, 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("last", a, 0);
+
+    return list_elem(e, a, a->cell[0]->count - 1);
+}
+
+LVAL* builtin_reverse(LENV *e, LVAL* a) {
+    LASSERT_NUM("reverse", a, 1);
+    LASSERT_TYPE("reverse", a, 0, LVAL_QEXPR);
+
+    LVAL* l = a->cell[0];
+    LVAL* x = list_of(l->count);
+    for (int i = 0; i < l->count; i++) {
+        x->cell[i] = lval_ref(l->cell[l->count-1-i]);
     }
 
-    /* Pop the first element */
-    LVAL* x = lval_pop(a, 0);
+    lval_del(a);
+    return x;
+}
+
+/* Where take, drop and split cut their list, clamped to its ends */
+static int list_cut(LVAL* a) {
+    long n = lnum(a->cell[0]);
+    int count = a->cell[1]->count;
+    return n < 0 ? 0 : n > count ? count : n;
+}
+
+LVAL* builtin_take(LENV *e, LVAL* a) {
+    LASSERT_NUM("take", a, 2);
+    LASSERT_TYPE("take", a, 0, LVAL_NUM);
+    LASSERT_TYPE("take", a, 1, LVAL_QEXPR);
+
+    int n = list_cut(a);
+    return lval_slice(lval_take(a, 1), 0, n);
+}
+
+LVAL* builtin_drop(LENV *e, LVAL* a) {
+    LASSERT_NUM("drop", a, 2);
+    LASSERT_TYPE("drop", a, 0, LVAL_NUM);
+    LASSERT_TYPE("drop", a, 1, LVAL_QEXPR);
+
+    int n = list_cut(a);
+    LVAL* l = lval_take(a, 1);
+    return lval_slice(l, n, l->count - n);
+}
+
+LVAL* builtin_split(LENV *e, LVAL* a) {
+    LASSERT_NUM("split", a, 2);
+    LASSERT_TYPE("split", a, 0, LVAL_NUM);
+    LASSERT_TYPE("split", a, 1, LVAL_QEXPR);
 
-    /* If no arguments and sub then perform unary negation */
-    if ((strcmp(op, "-") == 0) && a->count == 0) {
-        x->num = -x->num;
+    int n = list_cut(a);
+    LVAL* l = lval_take(a, 1);
+    LVAL* x = list_of(2);
+    x->cell[0] = lval_slice(lval_ref(l), 0, n);
+    x->cell[1] = lval_slice(l, n, l->count - n);
+    return x;
+}
+
+LVAL* builtin_zip(LENV *e, LVAL* a) {
+    LASSERT_NUM("zip", a, 2);
+    LASSERT_TYPE("zip", a, 0, LVAL_QEXPR);
+    LASSERT_TYPE("zip", a, 1, LVAL_QEXPR);
+
+    LVAL* l = a->cell[0];
+    LVAL* r = a->cell[1];
+    LVAL* x = list_of(l->count < r->count ? l->count : r->count);
+    for (int i = 0; i < x->count; i++) {
+        LVAL* pair = list_of(2);
+        pair->cell[0] = lval_ref(l->cell[i]);
+        pair->cell[1] = lval_ref(r->cell[i]);
+        x->cell[i] = pair;
     }
 
-    /* While there are still elements remaining */
-    while (a->count > 0) {
-        LVAL* y = lval_pop(a, 0);
+    lval_del(a);
+    return x;
+}
 
-        if ((strcmp(op, "/") == 0) || (strcmp(op, "%") == 0)) {
-            if (y->num == 0) {
-                lval_del(x);
-                lval_del(y);
-                x = lval_err("Division by zero"); break;
-            }
+static const char* op_names[] = {
+    "+", "-", "*", "/", "%", ">", "<", ">=", "<=", "==", "!="
+};
+
+/*
+ * Arithmetic kernels, one per operator, folding the arguments in place.
+ * Each returns 0 on overflow or division by zero, which are left to the
+ * bignum versions below.
+ */
+
+#define LOP_KERNEL(name, overflows)                                     \
+    static int name(LVAL** v, int n, long* r) {                         \
+        long x = lnum(v[0]);                                            \
+        for (int i = 1; i < n; i++) {                                   \
+            if (overflows(x, lnum(v[i]), &x)) { return 0; }             \
+        }                                                               \
+        *r = x;                                                         \
+        return 1;                                                       \
+    }
+
+LOP_KERNEL(lop_add, __builtin_add_overflow)
+LOP_KERNEL(lop_sub, __builtin_sub_overflow)
+LOP_KERNEL(lop_mul, __builtin_mul_overflow)
+
+static int lop_div(LVAL** v, int n, long* r) {
+    long x = lnum(v[0]);
+    for (int i = 1; i < n; i++) {
+        long y = lnum(v[i]);
+        if (y == 0) { return 0; }
+        if (y == -1) {
+            if (__builtin_sub_overflow(0, x, &x)) { return 0; }
+            continue;
         }
+        x /= y;
+    }
+    *r = x;
+    return 1;
+}
+
+static int lop_mod(LVAL** v, int n, long* r) {
+    long x = lnum(v[0]);
+    for (int i = 1; i < n; i++) {
+        long y = lnum(v[i]);
+        if (y == 0) { return 0; }
+        x = y == -1 ? 0 : x % y;
+    }
+    *r = x;
+    return 1;
+}
+
+static int (*const lop_kernels[])(LVAL**, int, long*) = {
+    lop_add, lop_sub, lop_mul, lop_div, lop_mod
+};
+
+static LVAL* (*const lop_bigs[])(LVAL*, LVAL*) = {
+    lbig_add, lbig_sub, lbig_mul, lbig_div, lbig_mod
+};
+
+/* Any float makes the whole operation one on doubles, like C */
+static double lop_float(int op, LVAL** v, int n) {
+    double x = lreal(v[0]);
+    for (int i = 1; i < n; i++) {
+        double y = lreal(v[i]);
+        switch (op) {
+        case LOP_ADD: x += y; break;
+        case LOP_SUB: x -= y; break;
+        case LOP_MUL: x *= y; break;
+        case LOP_DIV: x /= y; break;
+        case LOP_MOD: x = fmod(x, y); break;
+        }
+    }
+    return x;
+}
+
+LVAL* builtin_op(LVAL* a, int op) {
+    LASSERT(a, a->count > 0,
+            "Function '%s' passed no arguments.", op_names[op]);
+
+    /* Ensure all arguments are numbers */
+    int big = 0;
+    int flt = 0;
+    for (int i = 0; i < a->count; i++) {
+        LASSERT_NUMBER(op_names[op], a, i);
+        big |= ltype(a->cell[i]) == LVAL_BIG;
+        flt |= ltype(a->cell[i]) == LVAL_FLT;
+    }
+
+    /* If one argument and sub then perform unary negation */
+    int neg = op == LOP_SUB && a->count == 1;
+
+    if (flt) {
+        double x = neg ? -lreal(a->cell[0]) : lop_float(op, a->cell, a->count);
+        lval_del(a);
+        return lval_flt(x);
+    }
+
+    long x;
+    if (!big && (neg ? !__builtin_sub_overflow(0, lnum(a->cell[0]), &x)
+                     : lop_kernels[op](a->cell, a->count, &x))) {
+        lval_del(a);
+        return lval_num(x);
+    }
 
-        if (strcmp(op, "+") == 0) { x->num += y->num; }
-        if (strcmp(op, "-") == 0) { x->num -= y->num; }
-        if (strcmp(op, "*") == 0) { x->num *= y->num; }
-        if (strcmp(op, "/") == 0) { x->num /= y->num; }
-        if (strcmp(op, "%") == 0) { x->num %= y->num; }
+    /* Start over in bignums, demoting the result again if it fits */
+    if (neg || op == LOP_ADD || op == LOP_SUB) {
+        LVAL* r = neg ? lbig_neg(a->cell[0])
+                      : lbig_sum(a->cell, a->count, op == LOP_SUB);
+        lval_del(a);
+        return r;
+    }
 
-        lval_del(y);
+    LVAL* r = lval_ref(a->cell[0]);
+    for (int i = 1; i < a->count && ltype(r) != LVAL_ERR; i++) {
+        LVAL* y = lop_bigs[op](r, a->cell[i]);
+        lval_del(r);
+        r = y;
     }
 
     lval_del(a);
-    return x;
+    return r;
 }
 
 LVAL* builtin_add(LENV* e, LVAL* a) {
-    return builtin_op(a, "+");
+    return builtin_op(a, LOP_ADD);
 }
 
 LVAL* builtin_sub(LENV* e, LVAL* a) {
-    return builtin_op(a, "-");
+    return builtin_op(a, LOP_SUB);
 }
 
 LVAL* builtin_mul(LENV* e, LVAL* a) {
-    return builtin_op(a, "*");
+    return builtin_op(a, LOP_MUL);
 }
 
 LVAL* builtin_div(LENV* e, LVAL* a) {
-    return builtin_op(a, "/");
+    return builtin_op(a, LOP_DIV);
 }
 
 LVAL* builtin_mod(LENV* e, LVAL* a) {
-    return builtin_op(a, "%");
+    return builtin_op(a, LOP_MOD);
 }
 
-LVAL* builtin_ord(LENV* e, LVAL* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-    LASSERT_TYPE(op, a, 0, LVAL_NUM);
-    LASSERT_TYPE(op, a, 1, LVAL_NUM);
+#define LOP_ORD(name, type)                                             \
+    static int name(int op, type x, type y) {                           \
+        switch (op) {                                                   \
+        case LOP_GT: return x > y;                                      \
+        case LOP_LT: return x < y;                                      \
+        case LOP_GE: return x >= y;                                     \
+        case LOP_LE: return x <= y;                                     \
+        }                                                               \
+        return 0;                                                       \
+    }
+
+LOP_ORD(lop_ord, long)
+LOP_ORD(lop_ord_float, double)
 
+LVAL* builtin_ord(LENV* e, LVAL* a, int op) {
+    LASSERT_NUM(op_names[op], a, 2);
+    LASSERT_NUMBER(op_names[op], a, 0);
+    LASSERT_NUMBER(op_names[op], a, 1);
+
+    LVAL* x = a->cell[0];
+    LVAL* y = a->cell[1];
     int r;
-    if (strcmp(op, ">")  == 0) {
-        r = (a->cell[0]->num > a->cell[1]->num);
-    }
-    if (strcmp(op, "<")  == 0) {
-        r = (a->cell[0]->num < a->cell[1]->num);
-    }
-    if (strcmp(op, ">=") == 0) {
-        r = (a->cell[0]->num >= a->cell[1]->num);
-    }
-    if (strcmp(op, "<=") == 0) {
-        r = (a->cell[0]->num <= a->cell[1]->num);
+    if (ltype(x) == LVAL_FLT || ltype(y) == LVAL_FLT) {
+        r = lop_ord_float(op, lreal(x), lreal(y));
+    } else if (ltype(x) == LVAL_BIG || ltype(y) == LVAL_BIG) {
+        r = lop_ord(op, lbig_cmp(x, y), 0);
+    } else {
+        r = lop_ord(op, lnum(x), lnum(y));
     }
     lval_del(a);
-    return lval_num(r);
+    return lval_fixnum(r);
 }
 
 LVAL* builtin_gt(LENV* e, LVAL* a) {
-    return builtin_ord(e, a, ">");
+    return builtin_ord(e, a, LOP_GT);
 }
 
 LVAL* builtin_lt(LENV* e, LVAL* a) {
-    return builtin_ord(e, a, "<");
+    return builtin_ord(e, a, LOP_LT);
 }
 
 LVAL* builtin_ge(LENV* e, LVAL* a) {
-    return builtin_ord(e, a, ">=");
+    return builtin_ord(e, a, LOP_GE);
 }
 
 LVAL* builtin_le(LENV* e, LVAL* a) {
-    return builtin_ord(e, a, "<=");
+    return builtin_ord(e, a, LOP_LE);
 }
 
-LVAL* builtin_cmp(LENV* e, LVAL* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-    int r;
-    if (strcmp(op, "==") == 0) {
-        r =  lval_eq(a->cell[0], a->cell[1]);
-    }
-    if (strcmp(op, "!=") == 0) {
-        r = !lval_eq(a->cell[0], a->cell[1]);
-    }
+LVAL* builtin_cmp(LENV* e, LVAL* a, int op) {
+    LASSERT_NUM(op_names[op], a, 2);
+
+    int r = lval_eq(a->cell[0], a->cell[1]);
+    if (op == LOP_NE) { r = !r; }
     lval_del(a);
-    return lval_num(r);
+    return lval_fixnum(r);
 }
 
 LVAL* builtin_eq(LENV* e, LVAL* a) {
-    return builtin_cmp(e, a, "==");
+    return builtin_cmp(e, a, LOP_EQ);
 }
 
 LVAL* builtin_ne(LENV* e, LVAL* a) {
-    return builtin_cmp(e, a, "!=");
+    return builtin_cmp(e, a, LOP_NE);
 }
 
-LVAL* builtin_if(LENV* e, LVAL* a) {
+/* The branch if evaluates, or an error */
+LVAL* builtin_if_expr(LENV* e, LVAL* a) {
     LASSERT_NUM("if", a, 3);
-    LASSERT_TYPE("if", a, 0, LVAL_NUM);
+    LASSERT_NUMBER("if", a, 0);
     LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
     LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
 
+    /* Bignums are never zero */
+    LVAL* c = a->cell[0];
+    int cond = ltype(c) == LVAL_FLT ? c->flt != 0
+                                    : ltype(c) == LVAL_BIG || lnum(c) != 0;
+
+    /* Mark the chosen expression as evaluable */
+    LVAL* x = lval_own(lval_take(a, cond ? 1 : 2));
+    x->type = LVAL_SEXPR;
+    return x;
+}
+
+LVAL* builtin_if(LENV* e, LVAL* a) {
+    return lval_eval(e, builtin_if_expr(e, a));
+}
+
+/*
+ * Math function kernels, in place on an array of doubles. Where the
+ * hardware has an instruction for it, two go at a time.
+ */
+
+static void math_sqrt(double* x, int n) {
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(x + i, _mm_sqrt_pd(_mm_loadu_pd(x + i)));
+    }
+#endif
+    for (; i < n; i++) { x[i] = sqrt(x[i]); }
+}
+
+/*
+ * Without SSE4.1's roundpd, adding and taking away 2^52 rounds to an
+ * integer, which is one too many when it rounded up. Anything as big
+ * as that is an integer already, or not a number.
+ */
+static void math_floor(double* x, int n) {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128d sign = _mm_set1_pd(-0.0);
+    const __m128d big  = _mm_set1_pd(4503599627370496.0);
+    const __m128d one  = _mm_set1_pd(1.0);
+    for (; i + 2 <= n; i += 2) {
+        __m128d v = _mm_loadu_pd(x + i);
+        __m128d m = _mm_andnot_pd(sign, v);
+        __m128d r = _mm_sub_pd(_mm_add_pd(m, big), big);
+        r = _mm_or_pd(r, _mm_and_pd(v, sign));
+        r = _mm_sub_pd(r, _mm_and_pd(_mm_cmpgt_pd(r, v), one));
+        __m128d small = _mm_cmplt_pd(m, big);
+        _mm_storeu_pd(x + i, _mm_or_pd(_mm_and_pd(small, r),
+                                       _mm_andnot_pd(small, v)));
+    }
+#endif
+    for (; i < n; i++) { x[i] = floor(x[i]); }
+}
+
+static void math_exp(double* x, int n) {
+    for (int i = 0; i < n; i++) { x[i] = exp(x[i]); }
+}
+
+static void math_log(double* x, int n) {
+    for (int i = 0; i < n; i++) { x[i] = log(x[i]); }
+}
+
+/*
+ * A math function of a number, or of each of a list of them. For
+ * functions that leave whole numbers whole, integers are passed
+ * through as they are rather than rounded to a double.
+ */
+static LVAL* builtin_math(LVAL* a, char* func, void (*kernel)(double*, int),
+                          int whole) {
+    LASSERT_NUM(func, a, 1);
+
+    LVAL* x = a->cell[0];
+    if (whole && lval_is_number(x) && ltype(x) != LVAL_FLT) {
+        x = lval_ref(x);
+        lval_del(a);
+        return x;
+    }
+    if (lval_is_number(x)) {
+        double r = lreal(x);
+        kernel(&r, 1);
+        lval_del(a);
+        return lval_flt(r);
+    }
+
+    LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
+    for (int i = 0; i < x->count; i++) {
+        LASSERT(a, lval_is_number(x->cell[i]),
+                "Function '%s' passed a list holding %s, expected %s.",
+                func, ltype_name(ltype(x->cell[i])), ltype_name(LVAL_NUM));
+    }
+
+    double* v = malloc(sizeof(double) * x->count);
+    for (int i = 0; i < x->count; i++) { v[i] = lreal(x->cell[i]); }
+    kernel(v, x->count);
+
+    LVAL* r = lval_qexpr();
+    for (int i = 0; i < x->count; i++) {
+        LVAL* c = x->cell[i];
+        lval_add(r, whole && ltype(c) != LVAL_FLT ? lval_ref(c) : lval_flt(v[i]));
+    }
+    free(v);
+    lval_del(a);
+    return r;
+}
+
+LVAL* builtin_sqrt(LENV* e, LVAL* a) {
+    return builtin_math(a, "sqrt", math_sqrt, 0);
+}
+
+LVAL* builtin_exp(LENV* e, LVAL* a) {
+    return builtin_math(a, "exp", math_exp, 0);
+}
+
+LVAL* builtin_log(LENV* e, LVAL* a) {
+    return builtin_math(a, "log", math_log, 0);
+}
+
+LVAL* builtin_floor(LENV* e, LVAL* a) {
+    return builtin_math(a, "floor", math_floor, 1);
+}
+
+/* Packed vectors */
+
+LVAL* builtin_vec(LENV* e, LVAL* a) {
+    LASSERT_NUM("vec", a, 1);
+    LASSERT_TYPE("vec", a, 0, LVAL_QEXPR);
+
+    /* Floats if any are, integers otherwise */
+    LVAL* l = a->cell[0];
+    int type = LVAL_NUM;
+    for (int i = 0; i < l->count; i++) {
+        int t = ltype(l->cell[i]);
+        LASSERT(a, t != LVAL_BIG,
+                "Function 'vec' passed a number too big for a vec.");
+        LASSERT(a, t == LVAL_NUM || t == LVAL_FLT,
+                "Function 'vec' passed a list holding %s, expected %s.",
+                ltype_name(t), ltype_name(LVAL_NUM));
+        if (t == LVAL_FLT) { type = LVAL_FLT; }
+    }
+
+    LVEC* v = lvec_new(type, l->count);
+    for (int i = 0; i < l->count; i++) {
+        if (type == LVAL_FLT) { v->f[i] = lreal(l->cell[i]); }
+        else { v->i[i] = lnum(l->cell[i]); }
+    }
+    lval_del(a);
+    return lval_vec(v);
+}
+
+static LVAL* vec_elem(LVEC* v, int i) {
+    return v->type == LVAL_FLT ? lval_flt(v->f[i]) : lval_num(v->i[i]);
+}
+
+LVAL* builtin_vlist(LENV* e, LVAL* a) {
+    LASSERT_NUM("vlist", a, 1);
+    LASSERT_TYPE("vlist", a, 0, LVAL_VEC);
+
+    LVEC* v = a->cell[0]->vec;
+    LVAL* l = lval_qexpr();
+    for (int i = 0; i < v->count; i++) { lval_add(l, vec_elem(v, i)); }
+    lval_del(a);
+    return l;
+}
+
+LVAL* builtin_vref(LENV* e, LVAL* a) {
+    LASSERT_NUM("vref", a, 2);
+    LASSERT_TYPE("vref", a, 0, LVAL_VEC);
+    LASSERT_TYPE("vref", a, 1, LVAL_NUM);
+
+    LVEC* v = a->cell[0]->vec;
+    long i = lnum(a->cell[1]);
+    LASSERT(a, i >= 0 && i < v->count,
+            "Function 'vref' passed index %li, out of range for a vec of %i.",
+            i, v->count);
+
+    LVAL* x = vec_elem(v, i);
+    lval_del(a);
+    return x;
+}
+
+LVAL* builtin_vlen(LENV* e, LVAL* a) {
+    LASSERT_NUM("vlen", a, 1);
+    LASSERT_TYPE("vlen", a, 0, LVAL_VEC);
+
+    LVAL* x = lval_num(a->cell[0]->vec->count);
+    lval_del(a);
+    return x;
+}
+
+/* Elements as doubles, converting into *tmp if they're integers */
+static double* vec_doubles(LVEC* v, double** tmp) {
+    if (v->type == LVAL_FLT) { return v->f; }
+    *tmp = malloc(sizeof(double) * v->count);
+    for (int i = 0; i < v->count; i++) { (*tmp)[i] = v->i[i]; }
+    return *tmp;
+}
+
+/* Integer sum, or dot product with y, in bignums for when longs overflowed */
+static LVAL* vec_exact(const int64_t* x, const int64_t* y, int n) {
+    LVAL* s = lval_fixnum(0);
+    for (int i = 0; i < n; i++) {
+        LVAL* t = lval_num(x[i]);
+        if (y) {
+            LVAL* u = lval_num(y[i]);
+            LVAL* p = lbig_mul(t, u);
+            lval_del(t);
+            lval_del(u);
+            t = p;
+        }
+        LVAL* r = lbig_add(s, t);
+        lval_del(s);
+        lval_del(t);
+        s = r;
+    }
+    return s;
+}
+
+LVAL* builtin_vsum(LENV* e, LVAL* a) {
+    LASSERT_NUM("vsum", a, 1);
+    LASSERT_TYPE("vsum", a, 0, LVAL_VEC);
+
+    LVEC* v = a->cell[0]->vec;
     LVAL* x;
-    int cond = a->cell[0]->num;
+    int64_t r;
+    if (v->type == LVAL_FLT) { x = lval_flt(lvec_fsum(v->f, v->count)); }
+    else if (lvec_isum(v->i, v->count, &r)) { x = lval_num(r); }
+    else { x = vec_exact(v->i, NULL, v->count); }
+    lval_del(a);
+    return x;
+}
 
-    /* Mark both expressions as evaluable */
-    a->cell[1]->type = LVAL_SEXPR;
-    a->cell[2]->type = LVAL_SEXPR;
+LVAL* builtin_vdot(LENV* e, LVAL* a) {
+    LASSERT_NUM("vdot", a, 2);
+    LASSERT_TYPE("vdot", a, 0, LVAL_VEC);
+    LASSERT_TYPE("vdot", a, 1, LVAL_VEC);
 
-    x = cond ? lval_eval(e, lval_pop(a, 1))
-             : lval_eval(e, lval_pop(a, 2));
+    LVEC* v = a->cell[0]->vec;
+    LVEC* w = a->cell[1]->vec;
+    LASSERT(a, v->count == w->count,
+            "Function 'vdot' passed vecs of %i and %i.", v->count, w->count);
 
+    LVAL* x;
+    int64_t r;
+    if (v->type == LVAL_NUM && w->type == LVAL_NUM) {
+        x = lvec_idot(v->i, w->i, v->count, &r) ? lval_num(r)
+                                                : vec_exact(v->i, w->i, v->count);
+    } else {
+        double* tv = NULL;
+        double* tw = NULL;
+        x = lval_flt(lvec_fdot(vec_doubles(v, &tv), vec_doubles(w, &tw), v->count));
+        free(tv);
+        free(tw);
+    }
     lval_del(a);
     return x;
 }
 
+LVAL* builtin_vadd(LENV* e, LVAL* a) {
+    LASSERT_NUM("vmap+", a, 2);
+    LASSERT_TYPE("vmap+", a, 0, LVAL_VEC);
+    LASSERT_TYPE("vmap+", a, 1, LVAL_VEC);
+
+    LVEC* v = a->cell[0]->vec;
+    LVEC* w = a->cell[1]->vec;
+    LASSERT(a, v->count == w->count,
+            "Function 'vmap+' passed vecs of %i and %i.", v->count, w->count);
+
+    LVEC* r;
+    if (v->type == LVAL_NUM && w->type == LVAL_NUM) {
+        r = lvec_new(LVAL_NUM, v->count);
+        if (!lvec_iadd(r->i, v->i, w->i, v->count)) {
+            lvec_free(r);
+            lval_del(a);
+            return lval_err("Integer overflow");
+        }
+    } else {
+        double* tv = NULL;
+        double* tw = NULL;
+        r = lvec_new(LVAL_FLT, v->count);
+        lvec_fadd(r->f, vec_doubles(v, &tv), vec_doubles(w, &tw), v->count);
+        free(tv);
+        free(tw);
+    }
+    lval_del(a);
+    return lval_vec(r);
+}
+
+LVAL* builtin_vscale(LENV* e, LVAL* a) {
+    LASSERT_NUM("vscale", a, 2);
+    LASSERT_TYPE("vscale", a, 0, LVAL_VEC);
+    LASSERT(a, ltype(a->cell[1]) == LVAL_NUM || ltype(a->cell[1]) == LVAL_FLT,
+            "Function 'vscale' passed incorrect type for argument 2. Got %s, expected %s.",
+            ltype_name(ltype(a->cell[1])), ltype_name(LVAL_NUM));
+
+    LVEC* v = a->cell[0]->vec;
+    LVEC* r;
+    if (v->type == LVAL_NUM && ltype(a->cell[1]) == LVAL_NUM) {
+        r = lvec_new(LVAL_NUM, v->count);
+        if (!lvec_iscale(r->i, v->i, lnum(a->cell[1]), v->count)) {
+            lvec_free(r);
+            lval_del(a);
+            return lval_err("Integer overflow");
+        }
+    } else {
+        double* tv = NULL;
+        r = lvec_new(LVAL_FLT, v->count);
+        lvec_fscale(r->f, vec_doubles(v, &tv), lreal(a->cell[1]), v->count);
+        free(tv);
+    }
+    lval_del(a);
+    return lval_vec(r);
+}
+
+static LVAL* builtin_vextreme(LVAL* a, char* func, int max) {
+    LASSERT_NUM(func, a, 1);
+    LASSERT_TYPE(func, a, 0, LVAL_VEC);
+
+    LVEC* v = a->cell[0]->vec;
+    LASSERT(a, v->count > 0, "Function '%s' passed an empty vec.", func);
+
+    LVAL* x = v->type == LVAL_FLT ? lval_flt(lvec_fmin(v->f, v->count, max))
+                                  : lval_num(lvec_imin(v->i, v->count, max));
+    lval_del(a);
+    return x;
+}
+
+LVAL* builtin_vmin(LENV* e, LVAL* a) {
+    return builtin_vextreme(a, "vmin", 0);
+}
+
+LVAL* builtin_vmax(LENV* e, LVAL* a) {
+    return builtin_vextreme(a, "vmax", 1);
+}
+
+LVAL* builtin_vfilter_lt(LENV* e, LVAL* a) {
+    LASSERT_NUM("vfilter<", a, 2);
+    LASSERT_TYPE("vfilter<", a, 0, LVAL_VEC);
+    LASSERT(a, ltype(a->cell[1]) == LVAL_NUM || ltype(a->cell[1]) == LVAL_FLT,
+            "Function 'vfilter<' passed incorrect type for argument 2. Got %s, expected %s.",
+            ltype_name(ltype(a->cell[1])), ltype_name(LVAL_NUM));
+
+    /* Integers against a float compare as doubles, as < does */
+    LVEC* v = a->cell[0]->vec;
+    LVAL* k = a->cell[1];
+    int64_t* kept = malloc(sizeof(int64_t) * (v->count + 4));
+    int n = 0;
+    if (v->type == LVAL_FLT) {
+        n = lvec_ffilter_lt((double*)kept, v->f, v->count, lreal(k));
+    } else if (ltype(k) == LVAL_NUM) {
+        n = lvec_ifilter_lt(kept, v->i, v->count, lnum(k));
+    } else {
+        for (int i = 0; i < v->count; i++) {
+            if (v->i[i] < k->flt) { kept[n++] = v->i[i]; }
+        }
+    }
+
+    LVEC* r = lvec_new(v->type, n);
+    memcpy(r->i, kept, sizeof(int64_t) * n);
+    free(kept);
+    lval_del(a);
+    return lval_vec(r);
+}
+
+LVAL* builtin_optimized_body(LENV* e, LVAL* a) {
+    LASSERT_NUM("optimized-body", a, 1);
+    LASSERT_TYPE("optimized-body", a, 0, LVAL_FUN);
+    LASSERT(a, !a->cell[0]->builtin,
+            "Function 'optimized-body' passed a builtin, expected a lambda.");
+
+    LVAL* body = lval_ref(lopt_body(a->cell[0]));
+    lval_del(a);
+    return body;
+}
+
 LVAL* builtin_type(LENV* e, LVAL* a) {
-    char *s = ltype_name(a->cell[0]->type);
+    char *s = ltype_name(ltype(a->cell[0]));
     lval_del(a);
     return lval_str(s);
 }
@@ -296,6 +954,38 @@ LVAL* builtin_error(LENV* e, LVAL* a) {
     return err;
 }
 
+LVAL* builtin_alloc_stats(LENV* e, LVAL* a) {
+    lalloc_print_stats();
+    lval_del(a);
+    return lval_sexpr();
+}
+
+LVAL* builtin_gc(LENV* e, LVAL* a) {
+    LASSERT(a, lalloc_mode() == LALLOC_SLAB,
+            "Function 'gc' needs the slab allocator.");
+
+    lval_del(a);
+    return lval_num(lgc_collect());
+}
+
+LVAL* builtin_gc_stats(LENV* e, LVAL* a) {
+    lgc_print_stats();
+    lval_del(a);
+    return lval_sexpr();
+}
+
+LVAL* builtin_cache_stats(LENV* e, LVAL* a) {
+    lenv_print_stats();
+    lval_del(a);
+    return lval_sexpr();
+}
+
+/* Processor time used so far, in seconds, for timing things */
+LVAL* builtin_clock(LENV* e, LVAL* a) {
+    lval_del(a);
+    return lval_flt((double)clock() / CLOCKS_PER_SEC);
+}
+
 void lenv_register_builtin(LENV* e, char* name, LBUILTIN func) {
     LVAL* k = lval_sym(name);
     LVAL* v = lval_fun(func, name);
@@ -303,3 +993,130 @@ void lenv_register_builtin(LENV* e, char* name, LBUILTIN func) {
     lval_del(k);
     lval_del(v);
 }
+
+/**
+ * Evaluate one top-level form of a file, reporting any error.
+ */
+void builtin_load_form(LENV* e, LVAL* form) {
+    /* Temporaries of each form are released in one go, but only at top
+       level: loaded from inside a function, a form may grow the caller's
+       frame, so it has to live as long as the caller's own temporaries */
+    int top = !e->parent;
+    LREGION region;
+    if (top) { region = lalloc_region_enter(); }
+
+    LVAL* x = lval_eval(e, form);
+    if (ltype(x) == LVAL_ERR) { lval_println(x); }
+    lval_del(x);
+
+    if (top) {
+        lalloc_region_leave(region);
+        lgc_safepoint();
+    }
+}
+
+/**
+ * Load and parse file within a context of a given lenv.
+ */
+LVAL* builtin_load(LENV* e, LVAL* a) {
+    LASSERT_NUM("load", a, 1);
+    LASSERT_TYPE("load", a, 0, LVAL_STR);
+
+    /* Parse file given by string name */
+    mpc_result_t r;
+    if (mpc_parse_contents(a->cell[0]->str, Lispy, &r)) {
+        LVAL* expr = lval_read(r.output);
+        mpc_ast_delete(r.output);
+
+        while (expr->count) {
+            builtin_load_form(e, lval_pop(expr, 0));
+        }
+
+        lval_del(expr);
+        lval_del(a);
+        return lval_sexpr();
+    }
+    else {
+        char* err_msg = mpc_err_string(r.error);
+        mpc_err_delete(r.error);
+
+        LVAL* err = lval_err("Could not load %s", err_msg);
+        free(err_msg);
+        lval_del(a);
+        return err;
+    }
+}
+
+/**
+ * Register builtins for a given lenv.
+ */
+void lenv_register_builtins(LENV* e) {
+
+    /* String functions */
+    lenv_register_builtin(e, "load",  builtin_load);
+    lenv_register_builtin(e, "print", builtin_print);
+    lenv_register_builtin(e, "error", builtin_error);
+
+    /* Var functions */
+    lenv_register_builtin(e, "def",  builtin_def);
+    lenv_register_builtin(e, "=",    builtin_put);
+    lenv_register_builtin(e, "->",   builtin_lambda);
+    lenv_register_builtin(e, "type", builtin_type);
+    lenv_register_builtin(e, "optimized-body", builtin_optimized_body);
+
+    /* List functions */
+    lenv_register_builtin(e, "list",    builtin_list);
+    lenv_register_builtin(e, "len",     builtin_len);
+    lenv_register_builtin(e, "head",    builtin_head);
+    lenv_register_builtin(e, "tail",    builtin_tail);
+    lenv_register_builtin(e, "eval",    builtin_eval);
+    lenv_register_builtin(e, "join",    builtin_join);
+    lenv_register_builtin(e, "cons",    builtin_cons);
+    lenv_register_builtin(e, "nth",     builtin_nth);
+    lenv_register_builtin(e, "last",    builtin_last);
+    lenv_register_builtin(e, "reverse", builtin_reverse);
+    lenv_register_builtin(e, "take",    builtin_take);
+    lenv_register_builtin(e, "drop",    builtin_drop);
+    lenv_register_builtin(e, "split",   builtin_split);
+    lenv_register_builtin(e, "zip",     builtin_zip);
+
+    /* Math functions */
+    lenv_register_builtin(e, "+", builtin_add);
+    lenv_register_builtin(e, "-", builtin_sub);
+    lenv_register_builtin(e, "*", builtin_mul);
+    lenv_register_builtin(e, "/", builtin_div);
+    lenv_register_builtin(e, "%", builtin_mod);
+    lenv_register_builtin(e, "sqrt",  builtin_sqrt);
+    lenv_register_builtin(e, "exp",   builtin_exp);
+    lenv_register_builtin(e, "log",   builtin_log);
+    lenv_register_builtin(e, "floor", builtin_floor);
+
+    /* Vector functions */
+    lenv_register_builtin(e, "vec",      builtin_vec);
+    lenv_register_builtin(e, "vlist",    builtin_vlist);
+    lenv_register_builtin(e, "vref",     builtin_vref);
+    lenv_register_builtin(e, "vlen",     builtin_vlen);
+    lenv_register_builtin(e, "vsum",     builtin_vsum);
+    lenv_register_builtin(e, "vdot",     builtin_vdot);
+    lenv_register_builtin(e, "vmap+",    builtin_vadd);
+    lenv_register_builtin(e, "vscale",   builtin_vscale);
+    lenv_register_builtin(e, "vmin",     builtin_vmin);
+    lenv_register_builtin(e, "vmax",     builtin_vmax);
+    lenv_register_builtin(e, "vfilter<", builtin_vfilter_lt);
+
+    /* Comparison functions */
+    lenv_register_builtin(e, "if",  builtin_if);
+    lenv_register_builtin(e, "==",  builtin_eq);
+    lenv_register_builtin(e, "!=",  builtin_ne);
+    lenv_register_builtin(e, ">",   builtin_gt);
+    lenv_register_builtin(e, "<",   builtin_lt);
+    lenv_register_builtin(e, ">=",  builtin_ge);
+    lenv_register_builtin(e, "<=",  builtin_le);
+
+    /* Memory functions */
+    lenv_register_builtin(e, "alloc-stats", builtin_alloc_stats);
+    lenv_register_builtin(e, "gc",          builtin_gc);
+    lenv_register_builtin(e, "gc-stats",    builtin_gc_stats);
+    lenv_register_builtin(e, "cache-stats", builtin_cache_stats);
+    lenv_register_builtin(e, "clock",       builtin_clock);
+}
@@ -2,6 +2,7 @@
 #define builtin_h
 
 #include "lval.h"
+#include "lgc.h"
 
 LVAL* builtin_var(LENV* e, LVAL* a, char* func);
 LVAL* builtin_lambda(LENV* e, LVAL* a);
@@ -9,35 +10,78 @@ LVAL* builtin_def(LENV* e, LVAL* a);
 LVAL* builtin_put(LENV* e, LVAL* a);
 
 LVAL* builtin_eval(LENV *e, LVAL* a);
+LVAL* builtin_eval_expr(LENV *e, LVAL* a);
 LVAL* builtin_list(LENV *e, LVAL* a);
 LVAL* builtin_len(LENV *e, LVAL* a);
 LVAL* builtin_head(LENV *e, LVAL* a);
 LVAL* builtin_tail(LENV *e, LVAL* a);
 LVAL* builtin_join(LENV *e, LVAL* a);
 LVAL* builtin_cons(LENV *e, LVAL *a);
+LVAL* builtin_nth(LENV *e, LVAL* a);
+LVAL* builtin_last(LENV *e, LVAL* a);
+LVAL* builtin_reverse(LENV *e, LVAL* a);
+LVAL* builtin_take(LENV *e, LVAL* a);
+LVAL* builtin_drop(LENV *e, LVAL* a);
+LVAL* builtin_split(LENV *e, LVAL* a);
+LVAL* builtin_zip(LENV *e, LVAL* a);
 
-LVAL* builtin_op(LVAL* a, char* op);
+/* Arithmetic and comparison operators */
+enum {
+    LOP_ADD, LOP_SUB, LOP_MUL, LOP_DIV, LOP_MOD,
+    LOP_GT, LOP_LT, LOP_GE, LOP_LE, LOP_EQ, LOP_NE
+};
+
+LVAL* builtin_op(LVAL* a, int op);
 LVAL* builtin_add(LENV* e, LVAL* a);
 LVAL* builtin_sub(LENV* e, LVAL* a);
 LVAL* builtin_mul(LENV* e, LVAL* a);
 LVAL* builtin_div(LENV* e, LVAL* a);
 LVAL* builtin_mod(LENV* e, LVAL* a);
 
-LVAL* builtin_ord(LENV* e, LVAL* a, char* op);
+LVAL* builtin_ord(LENV* e, LVAL* a, int op);
 LVAL* builtin_gt(LENV* e, LVAL* a);
 LVAL* builtin_lt(LENV* e, LVAL* a);
 LVAL* builtin_ge(LENV* e, LVAL* a);
 LVAL* builtin_le(LENV* e, LVAL* a);
 
-LVAL* builtin_cmp(LENV* e, LVAL* a, char* op);
+LVAL* builtin_cmp(LENV* e, LVAL* a, int op);
 LVAL* builtin_eq(LENV* e, LVAL* a);
 LVAL* builtin_ne(LENV* e, LVAL* a);
 LVAL* builtin_if(LENV* e, LVAL* a);
+LVAL* builtin_if_expr(LENV* e, LVAL* a);
+
+/* Of a number, or element-wise of a list of them */
+LVAL* builtin_sqrt(LENV* e, LVAL* a);
+LVAL* builtin_exp(LENV* e, LVAL* a);
+LVAL* builtin_log(LENV* e, LVAL* a);
+LVAL* builtin_floor(LENV* e, LVAL* a);
 
+/* Packed vectors of numbers, made from lists and back with vec and vlist */
+LVAL* builtin_vec(LENV* e, LVAL* a);
+LVAL* builtin_vlist(LENV* e, LVAL* a);
+LVAL* builtin_vref(LENV* e, LVAL* a);
+LVAL* builtin_vlen(LENV* e, LVAL* a);
+LVAL* builtin_vsum(LENV* e, LVAL* a);
+LVAL* builtin_vdot(LENV* e, LVAL* a);
+LVAL* builtin_vadd(LENV* e, LVAL* a);
+LVAL* builtin_vscale(LENV* e, LVAL* a);
+LVAL* builtin_vmin(LENV* e, LVAL* a);
+LVAL* builtin_vmax(LENV* e, LVAL* a);
+LVAL* builtin_vfilter_lt(LENV* e, LVAL* a);
+
+LVAL* builtin_load(LENV* e, LVAL* a);
+void  builtin_load_form(LENV* e, LVAL* form);
 LVAL* builtin_type(LENV* e, LVAL* a);
+LVAL* builtin_optimized_body(LENV* e, LVAL* a);
 LVAL* builtin_print(LENV* e, LVAL* a);
 LVAL* builtin_error(LENV* e, LVAL* a);
 
+LVAL* builtin_alloc_stats(LENV* e, LVAL* a);
+LVAL* builtin_gc(LENV* e, LVAL* a);
+LVAL* builtin_gc_stats(LENV* e, LVAL* a);
+LVAL* builtin_cache_stats(LENV* e, LVAL* a);
+LVAL* builtin_clock(LENV* e, LVAL* a);
+
 void lenv_register_builtin(LENV* e, char* name, LBUILTIN func);
 void lenv_register_builtins(LENV* e);
 
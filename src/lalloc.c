@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lalloc.h"
+
+/*
+ * Slab allocator for small interpreter objects, with a region mode.
+ *
+ * Small blocks come from page-aligned 64 KiB pages, so the page header
+ * of any block is found by masking its address. Slab pages hand out one
+ * kind and size class each and recycle freed slots through per-class
+ * free lists. Freed value and env slots are stamped so that a walk over
+ * their pages can tell them from live ones.
+ *
+ * Region pages are shared by all classes and bump-allocated. While a
+ * region is entered, new small blocks come from it, and leaving the
+ * region releases everything allocated since in one go. Regions are
+ * the young generation: anything that has to outlive one is tenured
+ * out of it first, see lgc_tenure.
+ */
+
+typedef struct LPAGE {
+    struct LPAGE* next;
+    int region;
+} LPAGE;
+
+/* Keep blocks 16-aligned past the page header */
+#define LPAGE_HEADER ((sizeof(LPAGE) + 15) & ~(size_t)15)
+
+/*
+ * Free blocks are threaded through their first word. Values and envs
+ * keep a stamp there instead and link through the second one.
+ */
+typedef struct LFREE {
+    struct LFREE* next;
+} LFREE;
+
+typedef struct {
+    uintptr_t stamp;
+    struct LFREE* next;
+} LFREE_STAMPED;
+
+#define LFREE_STAMP (~(uintptr_t)0)
+
+typedef struct {
+    LFREE* free;
+    char*  bump;
+    char*  end;
+    LPAGE* pages;
+    int stamped;
+    LALLOC_STATS stats;
+} LSLAB;
+
+typedef struct {
+    LFREE* free[LALLOC_CLASSES];
+    char*  bump;
+    char*  end;
+    LPAGE* pages;
+    LPAGE* spare;
+    int depth;
+    int suspend;
+    unsigned long allocs;
+    unsigned long reused;
+    unsigned long pages_used;
+    LREGION_STATS stats;
+} LREGION_STATE;
+
+/* One slab per kind and size class, plus a stats-only slot for large blocks */
+static LSLAB slabs[LALLOC_KINDS][LALLOC_CLASSES + 1];
+static LREGION_STATE region;
+static int mode = LALLOC_SLAB;
+
+static int lalloc_class(size_t size) {
+    if (size == 0) { size = 1; }
+    int cls = (int)((size + LALLOC_GRAIN - 1) / LALLOC_GRAIN) - 1;
+    return cls < LALLOC_CLASSES ? cls : LALLOC_CLASSES;
+}
+
+static LPAGE* lalloc_page(void* p) {
+    return (LPAGE*)((uintptr_t)p & ~(uintptr_t)(LALLOC_PAGE - 1));
+}
+
+static LPAGE* lalloc_new_page(int in_region) {
+    LPAGE* p = aligned_alloc(LALLOC_PAGE, LALLOC_PAGE);
+    p->next = NULL;
+    p->region = in_region;
+    return p;
+}
+
+static void lalloc_free_pages(LPAGE* p) {
+    while (p) {
+        LPAGE* next = p->next;
+        free(p);
+        p = next;
+    }
+}
+
+/**
+ * Pick the allocation mode. LISPY_ALLOC=system routes everything
+ * through malloc/free, which keeps valgrind and friends useful.
+ * Regions are disabled in that mode.
+ */
+void lalloc_init(void) {
+    char* env = getenv("LISPY_ALLOC");
+    mode = (env && strcmp(env, "system") == 0) ? LALLOC_SYSTEM : LALLOC_SLAB;
+
+    for (int k = 0; k < LALLOC_KINDS; k++) {
+        for (int i = 0; i < LALLOC_CLASSES; i++) {
+            slabs[k][i].stats.size = (i + 1) * LALLOC_GRAIN;
+            slabs[k][i].stamped = (k != LALLOC_RAW);
+        }
+    }
+}
+
+/* Release all pages. Every block in them is gone afterwards. */
+void lalloc_cleanup(void) {
+    for (int k = 0; k < LALLOC_KINDS; k++) {
+        for (int i = 0; i < LALLOC_CLASSES; i++) {
+            LSLAB* s = &slabs[k][i];
+            lalloc_free_pages(s->pages);
+            s->pages = NULL;
+            s->free = NULL;
+            s->bump = s->end = NULL;
+        }
+    }
+
+    lalloc_free_pages(region.pages);
+    lalloc_free_pages(region.spare);
+    memset(&region, 0, sizeof(region));
+}
+
+int lalloc_mode(void) {
+    return mode;
+}
+
+/* Slabs */
+
+static void* lalloc_slab(LSLAB* s) {
+    /* Reuse a freed slot if there is one */
+    if (s->free) {
+        LFREE* f = s->free;
+        s->free = s->stamped ? ((LFREE_STAMPED*)f)->next : f->next;
+        s->stats.reused++;
+        return f;
+    }
+
+    /* Otherwise carve a new one off the current page */
+    if (s->bump + s->stats.size > s->end) {
+        LPAGE* p = lalloc_new_page(0);
+        p->next = s->pages;
+        s->pages = p;
+        s->stats.pages++;
+        s->bump = (char*)p + LPAGE_HEADER;
+        s->end = (char*)p + LALLOC_PAGE;
+    }
+
+    void* p = s->bump;
+    s->bump += s->stats.size;
+    return p;
+}
+
+/* Regions */
+
+static void* lalloc_region(int cls) {
+    size_t size = (cls + 1) * LALLOC_GRAIN;
+    region.allocs++;
+
+    if (region.free[cls]) {
+        LFREE* f = region.free[cls];
+        region.free[cls] = f->next;
+        region.reused++;
+        return f;
+    }
+
+    if (region.bump + size > region.end) {
+        LPAGE* p = region.spare;
+        if (p) {
+            region.spare = p->next;
+        } else {
+            p = lalloc_new_page(1);
+            region.pages_used++;
+        }
+        p->next = region.pages;
+        region.pages = p;
+        region.bump = (char*)p + LPAGE_HEADER;
+        region.end = (char*)p + LALLOC_PAGE;
+    }
+
+    void* p = region.bump;
+    region.bump += size;
+    return p;
+}
+
+/**
+ * Start a region. Small blocks allocated until the matching
+ * lalloc_region_leave are released together. Regions nest.
+ */
+LREGION lalloc_region_enter(void) {
+    LREGION r = { region.pages, region.bump };
+    if (mode == LALLOC_SLAB) { region.depth++; }
+    return r;
+}
+
+void lalloc_region_leave(LREGION r) {
+    if (mode != LALLOC_SLAB) { return; }
+
+    clock_t start = clock();
+
+    /* Hand pages allocated since the mark back to the spare list */
+    while (region.pages != r.page) {
+        LPAGE* p = region.pages;
+        region.pages = p->next;
+        p->next = region.spare;
+        region.spare = p;
+    }
+
+    region.bump = r.bump;
+    region.end = r.page ? (char*)r.page + LALLOC_PAGE : NULL;
+
+    /* Free lists may point past the mark, so drop them */
+    memset(region.free, 0, sizeof(region.free));
+
+    region.depth--;
+
+    double pause = (double)(clock() - start) / CLOCKS_PER_SEC;
+    region.stats.releases++;
+    region.stats.last_pause = pause;
+    region.stats.total_pause += pause;
+    if (pause > region.stats.max_pause) { region.stats.max_pause = pause; }
+}
+
+/* Temporarily allocate from the slabs even inside a region */
+void lalloc_region_suspend(void) {
+    region.suspend++;
+}
+
+void lalloc_region_resume(void) {
+    region.suspend--;
+}
+
+/* Whether an object from lalloc lives in a region */
+int lalloc_in_region(void* p) {
+    return mode == LALLOC_SLAB && p && lalloc_page(p)->region;
+}
+
+/* Whether new small blocks currently come from a region */
+int lalloc_region_active(void) {
+    return mode == LALLOC_SLAB && region.depth && !region.suspend;
+}
+
+/* Allocation */
+
+void* lalloc_kind(int kind, size_t size) {
+    int cls = lalloc_class(size);
+    LSLAB* s = &slabs[kind][cls];
+
+    if (mode == LALLOC_SYSTEM || cls == LALLOC_CLASSES) {
+        s->stats.allocs++;
+        return malloc(size);
+    }
+
+    if (lalloc_region_active()) {
+        return lalloc_region(cls);
+    }
+
+    s->stats.allocs++;
+    return lalloc_slab(s);
+}
+
+void lfree_kind(int kind, void* p, size_t size) {
+    if (!p) { return; }
+
+    int cls = lalloc_class(size);
+    LSLAB* s = &slabs[kind][cls];
+
+    if (mode == LALLOC_SYSTEM || cls == LALLOC_CLASSES) {
+        s->stats.frees++;
+        free(p);
+        return;
+    }
+
+    LFREE* f = p;
+    if (lalloc_page(p)->region) {
+        f->next = region.free[cls];
+        region.free[cls] = f;
+    } else if (s->stamped) {
+        LFREE_STAMPED* fs = p;
+        fs->stamp = LFREE_STAMP;
+        fs->next = s->free;
+        s->free = f;
+        s->stats.frees++;
+    } else {
+        f->next = s->free;
+        s->free = f;
+        s->stats.frees++;
+    }
+}
+
+void* lalloc(size_t size) {
+    return lalloc_kind(LALLOC_RAW, size);
+}
+
+void lfree(void* p, size_t size) {
+    lfree_kind(LALLOC_RAW, p, size);
+}
+
+/**
+ * Resize a block belonging to owner. The new block is allocated in
+ * the same space (slab or region) as owner, so growing something that
+ * outlives the current region never leaves it pointing into the region.
+ */
+void* lrealloc(void* owner, void* p, size_t old_size, size_t new_size) {
+    int old_cls = lalloc_class(old_size);
+    int new_cls = lalloc_class(new_size);
+
+    if (mode == LALLOC_SYSTEM ||
+        (old_cls == LALLOC_CLASSES && new_cls == LALLOC_CLASSES)) {
+        if (new_size == 0) { lfree(p, old_size); return NULL; }
+        slabs[LALLOC_RAW][new_cls].stats.allocs += (p == NULL);
+        return realloc(p, new_size);
+    }
+
+    /* Small blocks of the same class already fit */
+    if (p && new_size && old_cls == new_cls) { return p; }
+
+    int suspend = owner && !lalloc_in_region(owner);
+    if (suspend) { lalloc_region_suspend(); }
+
+    void* q = NULL;
+    if (new_size) {
+        q = lalloc(new_size);
+        if (p) { memcpy(q, p, old_size < new_size ? old_size : new_size); }
+    }
+    lfree(p, old_size);
+
+    if (suspend) { lalloc_region_resume(); }
+    return q;
+}
+
+/* Walking */
+
+/**
+ * Call fn on every live block of a kind that came from the slabs.
+ * Region and large blocks are not visited.
+ */
+void lalloc_walk(int kind, void (*fn)(void* p, void* ctx), void* ctx) {
+    if (mode != LALLOC_SLAB) { return; }
+
+    for (int i = 0; i < LALLOC_CLASSES; i++) {
+        LSLAB* s = &slabs[kind][i];
+        size_t size = s->stats.size;
+
+        for (LPAGE* pg = s->pages; pg; pg = pg->next) {
+            /* Only the newest page is partially carved */
+            char* end = (pg == s->pages) ? s->bump : (char*)pg + LALLOC_PAGE;
+
+            for (char* q = (char*)pg + LPAGE_HEADER; q + size <= end; q += size) {
+                if (((LFREE_STAMPED*)q)->stamp != LFREE_STAMP) { fn(q, ctx); }
+            }
+        }
+    }
+}
+
+/* Bytes held by live values and envs in the slabs */
+size_t lalloc_heap_bytes(void) {
+    size_t total = 0;
+    for (int k = LALLOC_VAL; k < LALLOC_KINDS; k++) {
+        for (int i = 0; i < LALLOC_CLASSES; i++) {
+            LALLOC_STATS st = slabs[k][i].stats;
+            total += (st.allocs - st.frees) * st.size;
+        }
+    }
+    return total;
+}
+
+/* Stats */
+
+LALLOC_STATS lalloc_stats(int kind, int cls) {
+    return slabs[kind][cls].stats;
+}
+
+LREGION_STATS lalloc_region_stats(void) {
+    return region.stats;
+}
+
+void lalloc_print_stats(void) {
+    static char* kinds[] = { "raw", "val", "env" };
+
+    printf("%-4s %-6s %10s %10s %10s %6s %6s\n",
+           "kind", "size", "allocs", "frees", "reused", "pages", "hit%");
+
+    for (int k = 0; k < LALLOC_KINDS; k++) {
+        for (int i = 0; i <= LALLOC_CLASSES; i++) {
+            LALLOC_STATS st = slabs[k][i].stats;
+            if (st.allocs == 0) { continue; }
+
+            char size[16];
+            if (i == LALLOC_CLASSES) {
+                snprintf(size, sizeof(size), ">%d", LALLOC_CLASSES * LALLOC_GRAIN);
+            } else {
+                snprintf(size, sizeof(size), "%zu", st.size);
+            }
+
+            printf("%-4s %-6s %10lu %10lu %10lu %6lu %5.1f%%\n",
+                   kinds[k], size, st.allocs, st.frees, st.reused, st.pages,
+                   100.0 * st.reused / st.allocs);
+        }
+    }
+
+    if (region.allocs) {
+        printf("%-4s %-6s %10lu %10s %10lu %6lu %5.1f%%\n",
+               "-", "region", region.allocs, "-", region.reused,
+               region.pages_used, 100.0 * region.reused / region.allocs);
+        printf("region releases: %lu\n", region.stats.releases);
+    }
+    printf("mode: %s\n", mode == LALLOC_SYSTEM ? "system" : "slab");
+}
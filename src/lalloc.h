@@ -0,0 +1,75 @@
+#ifndef lalloc_h
+#define lalloc_h
+
+#include <stddef.h>
+
+/* Slab size classes: multiples of 8 bytes up to 128, larger goes to malloc */
+#define LALLOC_GRAIN   8
+#define LALLOC_CLASSES 16
+#define LALLOC_PAGE    (64 * 1024)
+
+enum {
+    LALLOC_SLAB,
+    LALLOC_SYSTEM
+};
+
+/*
+ * Kinds of block. Values and envs get slabs of their own so that the
+ * collector can walk them; everything else (cell arrays, strings, env
+ * arrays) is raw.
+ */
+enum {
+    LALLOC_RAW,
+    LALLOC_VAL,
+    LALLOC_ENV,
+    LALLOC_KINDS
+};
+
+typedef struct {
+    size_t size;
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long reused;
+    unsigned long pages;
+} LALLOC_STATS;
+
+struct LPAGE;
+
+typedef struct {
+    unsigned long releases;
+    double last_pause;
+    double max_pause;
+    double total_pause;
+} LREGION_STATS;
+
+/* Position in the region stack to release back to */
+typedef struct {
+    struct LPAGE* page;
+    char* bump;
+} LREGION;
+
+void  lalloc_init(void);
+void  lalloc_cleanup(void);
+int   lalloc_mode(void);
+
+void* lalloc(size_t size);
+void  lfree(void* p, size_t size);
+void* lrealloc(void* owner, void* p, size_t old_size, size_t new_size);
+
+void* lalloc_kind(int kind, size_t size);
+void  lfree_kind(int kind, void* p, size_t size);
+void  lalloc_walk(int kind, void (*fn)(void* p, void* ctx), void* ctx);
+size_t lalloc_heap_bytes(void);
+
+LREGION lalloc_region_enter(void);
+void    lalloc_region_leave(LREGION r);
+void    lalloc_region_suspend(void);
+void    lalloc_region_resume(void);
+int     lalloc_in_region(void* p);
+int     lalloc_region_active(void);
+
+LALLOC_STATS  lalloc_stats(int kind, int cls);
+LREGION_STATS lalloc_region_stats(void);
+void lalloc_print_stats(void);
+
+#endif
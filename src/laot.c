@@ -0,0 +1,567 @@
+#include <stdarg.h>
+
+#include "laot.h"
+#include "lparse.h"
+#include "lgc.h"
+#include "leval.h"
+#include "lvm.h"
+
+/*
+ * Ahead-of-time compiler.
+ *
+ * lispy --compile turns source files into a C program that builds each
+ * top-level form directly rather than parsing it, and evaluates it with
+ * the interpreter from liblispy.a. Functions whose bodies are only
+ * arithmetic and comparisons on their arguments, if, and calls to such
+ * functions, are also compiled to C functions on unboxed longs, which
+ * stand in for the lambdas while the names they use keep their
+ * bindings. Native code that would overflow or divide by zero gives up
+ * and the whole call is interpreted instead; having no side effects,
+ * it can simply be started again.
+ */
+
+jmp_buf laot_bail;
+long laot_depth;
+
+/* Builtins native code does itself */
+enum {
+    LN_ADD, LN_SUB, LN_MUL, LN_DIV, LN_MOD,
+    LN_LT, LN_GT, LN_LE, LN_GE, LN_EQ, LN_NE,
+    LN_IF
+};
+
+static const struct {
+    const char* name;
+    LBUILTIN builtin;
+    const char* c;      /* function or operator in C */
+} ops[] = {
+    { "+",  builtin_add, "laot_add" }, { "-",  builtin_sub, "laot_sub" },
+    { "*",  builtin_mul, "laot_mul" }, { "/",  builtin_div, "laot_div" },
+    { "%",  builtin_mod, "laot_mod" },
+    { "<",  builtin_lt,  "<" },  { ">",  builtin_gt,  ">" },
+    { "<=", builtin_le,  "<=" }, { ">=", builtin_ge,  ">=" },
+    { "==", builtin_eq,  "==" }, { "!=", builtin_ne,  "!=" },
+    { "if", builtin_if,  NULL },
+};
+
+#define NOPS ((int)(sizeof(ops) / sizeof(ops[0])))
+
+static int op_index(const char* sym) {
+    for (int i = 0; i < NOPS; i++) {
+        if (strcmp(ops[i].name, sym) == 0) { return i; }
+    }
+    return -1;
+}
+
+/* Runtime */
+
+static LENV* root;
+static LNATIVE** attached;
+static int nattached;
+
+LENV* laot_start(void) {
+    lalloc_init();
+    lgc_init();
+    lsym_init();
+    lparse_init();
+
+    root = lenv_new();
+    lgc_root(root);
+    lenv_register_builtins(root);
+    return root;
+}
+
+int laot_finish(LENV* e) {
+    for (int i = 0; i < nattached; i++) {
+        free(attached[i]->syms);
+        free(attached[i]->versions);
+    }
+    free(attached);
+
+    lgc_unroot(e);
+    lenv_del(e);
+    lgc_cleanup();
+    lalloc_cleanup();
+    lsym_cleanup();
+    leval_cleanup();
+    lvm_cleanup();
+    lparse_cleanup();
+    return 0;
+}
+
+/* A list of the given type holding the given values */
+LVAL* laot_list(int type, int count, ...) {
+    LVAL* v = type == LVAL_QEXPR ? lval_qexpr() : lval_sexpr();
+
+    va_list ap;
+    va_start(ap, count);
+    for (int i = 0; i < count; i++) { lval_add(v, va_arg(ap, LVAL*)); }
+    va_end(ap);
+    return v;
+}
+
+/* Whether the name is bound only globally, and to what the dep expects */
+static int dep_bound(LDEP* d, char* sym) {
+    if (lsym_of(sym)->binds != 1) { return 0; }
+
+    LVAL* k = lval_sym(sym);
+    LVAL* v = lenv_get(root, k);
+    lval_del(k);
+
+    int ok = ltype(v) == LVAL_FUN;
+    if (ok && d->native) {
+        ok = !v->builtin && v->native == d->native;
+    } else if (ok) {
+        ok = v->builtin == ops[op_index(d->name)].builtin;
+    }
+    lval_del(v);
+    return ok;
+}
+
+static int deps_hold(LNATIVE* n) {
+    for (int i = 0; i < n->ndeps; i++) {
+        unsigned version = lsym_of(n->syms[i])->version;
+        if (version == n->versions[i]) { continue; }
+
+        if (!dep_bound(&n->deps[i], n->syms[i])) { return 0; }
+        n->versions[i] = version;
+    }
+    return 1;
+}
+
+/**
+ * Let native code stand in for the global function of its name, if
+ * that was defined from the formals and body the code was compiled
+ * from, and the names the code relies on are bound as expected.
+ */
+void laot_attach(LENV* e, LNATIVE* n, LVAL* formals, LVAL* body) {
+    LVAL* k = lval_sym((char*)n->name);
+    LVAL* f = lenv_get(e, k);
+    lval_del(k);
+
+    int same = ltype(f) == LVAL_FUN && !f->builtin && f->env->count == 0
+            && lval_same(f->formals, formals) && lval_same(f->body, body);
+    lval_del(formals);
+    lval_del(body);
+
+    if (same && !n->syms) {
+        while (n->deps[n->ndeps].name) { n->ndeps++; }
+        n->syms = malloc(sizeof(char*) * n->ndeps);
+        n->versions = malloc(sizeof(unsigned) * n->ndeps);
+        for (int i = 0; i < n->ndeps; i++) {
+            n->syms[i] = lsym_intern((char*)n->deps[i].name);
+        }
+        attached = realloc(attached, sizeof(LNATIVE*) * (nattached + 1));
+        attached[nattached++] = n;
+    }
+
+    if (same) {
+        f->native = n;
+        for (int i = 0; i < n->ndeps; i++) {
+            if (!dep_bound(&n->deps[i], n->syms[i])) { f->native = NULL; break; }
+            n->versions[i] = lsym_of(n->syms[i])->version;
+        }
+    }
+    lval_del(f);
+}
+
+/**
+ * Call a function through its native code, taking over f and a. Returns
+ * NULL, with neither touched, when the call has to be interpreted.
+ */
+LVAL* laot_call(LVAL* f, LVAL* a) {
+    LNATIVE* n = f->native;
+    long args[LAOT_MAX_ARGS];
+
+    /* Native code knows nothing of depth limits */
+    if (a->count != n->arity || leval_max_depth) { return NULL; }
+
+    for (int i = 0; i < a->count; i++) {
+        if (ltype(a->cell[i]) != LVAL_NUM) { return NULL; }
+        args[i] = lnum(a->cell[i]);
+    }
+    if (!deps_hold(n)) { return NULL; }
+
+    laot_depth = 0;
+    if (setjmp(laot_bail)) { return NULL; }
+    long r = n->entry(args);
+
+    lval_del(f);
+    lval_del(a);
+    return lval_num(r);
+}
+
+/* Compiler */
+
+typedef struct {
+    FILE* out;
+
+    /* Natives so far, by name and arity */
+    char** names;
+    int* arity;
+    int count;
+
+    /* The function being looked at */
+    LVAL* formals;
+    char** deps;
+    int ndeps;
+} LAOT;
+
+static int formal(LAOT* A, char* sym) {
+    for (int i = 0; i < A->formals->count; i++) {
+        if (A->formals->cell[i]->sym == sym) { return i; }
+    }
+    return -1;
+}
+
+static int native_index(LAOT* A, char* sym) {
+    for (int i = 0; i < A->count; i++) {
+        if (A->names[i] == sym) { return i; }
+    }
+    return -1;
+}
+
+static void add_dep(LAOT* A, char* sym) {
+    for (int i = 0; i < A->ndeps; i++) {
+        if (A->deps[i] == sym) { return; }
+    }
+    A->deps = realloc(A->deps, sizeof(char*) * (A->ndeps + 1));
+    A->deps[A->ndeps++] = sym;
+}
+
+static int numeric(LAOT* A, LVAL* x);
+
+/* Whether evaluating the list is sure to give a number natively */
+static int numeric_seq(LAOT* A, LVAL* x) {
+    if (x->count == 0) { return 0; }
+    if (x->count == 1) { return numeric(A, x->cell[0]); }
+
+    LVAL* h = x->cell[0];
+    if (ltype(h) != LVAL_SYM || formal(A, h->sym) >= 0) { return 0; }
+
+    int args = x->count - 1;
+    int op = op_index(h->sym);
+    int ok = 1;
+
+    if (op == LN_IF) {
+        ok = args == 3
+          && ltype(x->cell[2]) == LVAL_QEXPR && ltype(x->cell[3]) == LVAL_QEXPR
+          && numeric(A, x->cell[1])
+          && numeric_seq(A, x->cell[2]) && numeric_seq(A, x->cell[3]);
+    } else {
+        int g = native_index(A, h->sym);
+        if (op >= LN_LT)  { ok = args == 2; }
+        else if (op < 0)  { ok = g >= 0 && A->arity[g] == args; }
+        for (int i = 1; ok && i < x->count; i++) { ok = numeric(A, x->cell[i]); }
+    }
+
+    if (ok) { add_dep(A, h->sym); }
+    return ok;
+}
+
+static int numeric(LAOT* A, LVAL* x) {
+    switch (ltype(x)) {
+    case LVAL_NUM:   return 1;
+    case LVAL_SYM:   return formal(A, x->sym) >= 0;
+    case LVAL_SEXPR: return numeric_seq(A, x);
+    }
+    return 0;
+}
+
+static void emit_num(LAOT* A, LVAL* x);
+
+static void emit_seq(LAOT* A, LVAL* x) {
+    FILE* o = A->out;
+    if (x->count == 1) {
+        emit_num(A, x->cell[0]);
+        return;
+    }
+
+    char* h = x->cell[0]->sym;
+    int args = x->count - 1;
+    int op = op_index(h);
+
+    if (op == LN_IF) {
+        fputs("(", o);
+        emit_num(A, x->cell[1]);
+        fputs(" ? ", o);
+        emit_seq(A, x->cell[2]);
+        fputs(" : ", o);
+        emit_seq(A, x->cell[3]);
+        fputs(")", o);
+    } else if (op >= LN_LT) {
+        fputs("(long)(", o);
+        emit_num(A, x->cell[1]);
+        fprintf(o, " %s ", ops[op].c);
+        emit_num(A, x->cell[2]);
+        fputs(")", o);
+    } else if (op == LN_SUB && args == 1) {
+        fputs("laot_neg(", o);
+        emit_num(A, x->cell[1]);
+        fputs(")", o);
+    } else if (op >= 0) {
+        /* Folded left to right, as the builtins do */
+        for (int i = 1; i < args; i++) { fprintf(o, "%s(", ops[op].c); }
+        emit_num(A, x->cell[1]);
+        for (int i = 2; i <= args; i++) {
+            fputs(", ", o);
+            emit_num(A, x->cell[i]);
+            fputs(")", o);
+        }
+    } else {
+        fprintf(o, "lf_%d(", native_index(A, h));
+        for (int i = 1; i <= args; i++) {
+            if (i > 1) { fputs(", ", o); }
+            emit_num(A, x->cell[i]);
+        }
+        fputs(")", o);
+    }
+}
+
+static void emit_num(LAOT* A, LVAL* x) {
+    switch (ltype(x)) {
+    case LVAL_NUM:
+        if (lnum(x) == LONG_MIN) { fprintf(A->out, "(-%ldL - 1)", LONG_MAX); }
+        else { fprintf(A->out, "%ldL", lnum(x)); }
+        break;
+    case LVAL_SYM:   fprintf(A->out, "a%d", formal(A, x->sym)); break;
+    case LVAL_SEXPR: emit_seq(A, x); break;
+    }
+}
+
+static void emit_cstr(FILE* o, char* s) {
+    fputc('"', o);
+    for (unsigned char* c = (unsigned char*)s; *c; c++) {
+        if (*c == '"' || *c == '\\') { fprintf(o, "\\%c", *c); }
+        else if (*c >= 32 && *c < 127) { fputc(*c, o); }
+        else { fprintf(o, "\\%03o", *c); }
+    }
+    fputc('"', o);
+}
+
+/* C code that builds the value */
+static void emit_val(FILE* o, LVAL* x, int indent) {
+    switch (ltype(x)) {
+    case LVAL_NUM:
+        if (lnum(x) == LONG_MIN) { fprintf(o, "lval_num(-%ldL - 1)", LONG_MAX); }
+        else { fprintf(o, "lval_num(%ldL)", lnum(x)); }
+        break;
+    case LVAL_BIG: {
+        char* s = lbig_str(x->big);
+        fprintf(o, "lbig_parse(\"%s\")", s);
+        free(s);
+        break;
+    }
+    case LVAL_FLT:
+        if (isinf(x->flt)) { fprintf(o, "lval_flt(%sHUGE_VAL)", x->flt < 0 ? "-" : ""); }
+        else { fprintf(o, "lval_flt(%a)", x->flt); }
+        break;
+    case LVAL_SYM: fputs("lval_sym(", o); emit_cstr(o, x->sym); fputs(")", o); break;
+    case LVAL_STR: fputs("lval_str(", o); emit_cstr(o, x->str); fputs(")", o); break;
+    case LVAL_ERR: fputs("lval_err(\"%s\", ", o); emit_cstr(o, x->err); fputs(")", o); break;
+
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+        fprintf(o, "laot_list(%s, %d",
+                ltype(x) == LVAL_QEXPR ? "LVAL_QEXPR" : "LVAL_SEXPR", x->count);
+        for (int i = 0; i < x->count; i++) {
+            fprintf(o, ",\n%*s", indent + 4, "");
+            emit_val(o, x->cell[i], indent + 4);
+        }
+        fputs(")", o);
+        break;
+    }
+}
+
+/* Formals and body of a function definition, if the form is one */
+static char* definition(LVAL* x, LVAL** formals, LVAL** body) {
+    if (ltype(x) != LVAL_SEXPR || x->count != 3) { return NULL; }
+    if (ltype(x->cell[0]) != LVAL_SYM || ltype(x->cell[1]) != LVAL_QEXPR) { return NULL; }
+    LVAL* sig = x->cell[1];
+    char* head = x->cell[0]->sym;
+
+    /* (defn {name formals...} {body}) */
+    if (strcmp(head, "defn") == 0 && ltype(x->cell[2]) == LVAL_QEXPR) {
+        *formals = lval_qexpr();
+        for (int i = 1; i < sig->count; i++) { lval_add(*formals, lval_ref(sig->cell[i])); }
+        *body = lval_ref(x->cell[2]);
+    }
+    /* (def {name} (-> {formals...} {body})), or with fn */
+    else if (strcmp(head, "def") == 0 && sig->count == 1 &&
+             ltype(x->cell[2]) == LVAL_SEXPR && x->cell[2]->count == 3 &&
+             ltype(x->cell[2]->cell[0]) == LVAL_SYM &&
+             (strcmp(x->cell[2]->cell[0]->sym, "->") == 0 ||
+              strcmp(x->cell[2]->cell[0]->sym, "fn") == 0) &&
+             ltype(x->cell[2]->cell[1]) == LVAL_QEXPR &&
+             ltype(x->cell[2]->cell[2]) == LVAL_QEXPR) {
+        *formals = lval_ref(x->cell[2]->cell[1]);
+        *body = lval_ref(x->cell[2]->cell[2]);
+    }
+    else {
+        return NULL;
+    }
+
+    if (sig->count == 0 || ltype(sig->cell[0]) != LVAL_SYM) {
+        lval_del(*formals);
+        lval_del(*body);
+        return NULL;
+    }
+    return sig->cell[0]->sym;
+}
+
+/* Whether the formals are plain, distinct, and few enough */
+static int plain_formals(LVAL* formals) {
+    if (formals->count == 0 || formals->count > LAOT_MAX_ARGS) { return 0; }
+    for (int i = 0; i < formals->count; i++) {
+        if (ltype(formals->cell[i]) != LVAL_SYM) { return 0; }
+        if (formals->cell[i]->sym == lsym_amp) { return 0; }
+        for (int j = 0; j < i; j++) {
+            if (formals->cell[j]->sym == formals->cell[i]->sym) { return 0; }
+        }
+    }
+    return 1;
+}
+
+/* Emit a native for the definition if it's numeric, returning its index */
+static int compile_native(LAOT* A, char* name, LVAL* formals, LVAL* body) {
+    if (!plain_formals(formals)) { return -1; }
+
+    /* It may call itself */
+    A->names = realloc(A->names, sizeof(char*) * (A->count + 1));
+    A->arity = realloc(A->arity, sizeof(int) * (A->count + 1));
+    A->names[A->count] = name;
+    A->arity[A->count] = formals->count;
+    A->count++;
+
+    A->formals = formals;
+    A->ndeps = 0;
+    if (!numeric_seq(A, body)) {
+        A->count--;
+        return -1;
+    }
+
+    int id = A->count - 1;
+    FILE* o = A->out;
+    fprintf(o, "static LNATIVE lf_%d_native;\n\n", id);
+
+    fprintf(o, "static long lf_%d(", id);
+    for (int i = 0; i < formals->count; i++) {
+        fprintf(o, "%slong a%d", i ? ", " : "", i);
+    }
+    fputs(") {\n    laot_enter();\n    long r = ", o);
+    emit_seq(A, body);
+    fputs(";\n    laot_depth--;\n    return r;\n}\n\n", o);
+
+    fprintf(o, "static long lf_%d_entry(long* a) {\n    return lf_%d(", id, id);
+    for (int i = 0; i < formals->count; i++) {
+        fprintf(o, "%sa[%d]", i ? ", " : "", i);
+    }
+    fputs(");\n}\n\n", o);
+
+    fprintf(o, "static LDEP lf_%d_deps[] = {\n", id);
+    for (int i = 0; i < A->ndeps; i++) {
+        int g = native_index(A, A->deps[i]);
+        fputs("    { ", o);
+        emit_cstr(o, A->deps[i]);
+        if (op_index(A->deps[i]) >= 0) { fputs(", NULL },\n", o); }
+        else { fprintf(o, ", &lf_%d_native },\n", g); }
+    }
+    fputs("    { NULL, NULL }\n};\n\n", o);
+
+    fprintf(o, "static LNATIVE lf_%d_native = { ", id);
+    emit_cstr(o, name);
+    fprintf(o, ", %d, lf_%d_entry, lf_%d_deps };\n\n", formals->count, id, id);
+    return id;
+}
+
+/* Read a file's top-level forms onto the end of forms */
+static int read_forms(char* file, LVAL* forms) {
+    mpc_result_t r;
+    if (!mpc_parse_contents(file, Lispy, &r)) {
+        mpc_err_print(r.error);
+        mpc_err_delete(r.error);
+        return 0;
+    }
+
+    LVAL* expr = lval_read(r.output);
+    mpc_ast_delete(r.output);
+    while (expr->count) { lval_add(forms, lval_pop(expr, 0)); }
+    lval_del(expr);
+    return 1;
+}
+
+/**
+ * Compile the files, in order, to one C program. Writes to stdout if
+ * out is NULL. Returns 0 on failure.
+ */
+int laot_compile(char* out, char** files, int nfiles) {
+    LVAL* forms = lval_sexpr();
+    for (int i = 0; i < nfiles; i++) {
+        if (!read_forms(files[i], forms)) {
+            lval_del(forms);
+            return 0;
+        }
+    }
+
+    FILE* o = out ? fopen(out, "w") : stdout;
+    if (!o) {
+        perror(out);
+        lval_del(forms);
+        return 0;
+    }
+
+    fputs("/* Generated by lispy --compile from", o);
+    for (int i = 0; i < nfiles; i++) { fprintf(o, " %s", files[i]); }
+    fputs(" */\n\n#include \"laot.h\"\n\n", o);
+
+    LAOT A = { o, NULL, NULL, 0, NULL, NULL, 0 };
+    int* native = malloc(sizeof(int) * (forms->count + 1));
+
+    for (int i = 0; i < forms->count; i++) {
+        LVAL* formals;
+        LVAL* body;
+        char* name = definition(forms->cell[i], &formals, &body);
+
+        native[i] = -1;
+        if (name) {
+            native[i] = compile_native(&A, name, formals, body);
+            lval_del(formals);
+            lval_del(body);
+        }
+    }
+
+    for (int i = 0; i < forms->count; i++) {
+        fprintf(o, "static void form_%d(LENV* e) {\n", i);
+        fputs("    builtin_load_form(e,\n        ", o);
+        emit_val(o, forms->cell[i], 8);
+        fputs(");\n", o);
+
+        if (native[i] >= 0) {
+            LVAL* formals;
+            LVAL* body;
+            definition(forms->cell[i], &formals, &body);
+
+            fprintf(o, "    laot_attach(e, &lf_%d_native,\n        ", native[i]);
+            emit_val(o, formals, 8);
+            fputs(",\n        ", o);
+            emit_val(o, body, 8);
+            fputs(");\n", o);
+
+            lval_del(formals);
+            lval_del(body);
+        }
+        fputs("}\n\n", o);
+    }
+
+    fputs("int main(void) {\n    LENV* e = laot_start();\n", o);
+    for (int i = 0; i < forms->count; i++) { fprintf(o, "    form_%d(e);\n", i); }
+    fputs("    return laot_finish(e);\n}\n", o);
+
+    if (out) { fclose(o); }
+    free(native);
+    free(A.names);
+    free(A.arity);
+    free(A.deps);
+    lval_del(forms);
+    return 1;
+}
@@ -0,0 +1,99 @@
+#ifndef laot_h
+#define laot_h
+
+#include <setjmp.h>
+#include <limits.h>
+
+#include "lval.h"
+#include "lenv.h"
+#include "builtin.h"
+#include "lbig.h"
+
+/* Most arguments a native function can take */
+#define LAOT_MAX_ARGS 8
+
+/* Deepest native recursion before leaving it to the interpreter */
+#define LAOT_MAX_DEPTH 100000
+
+struct LNATIVE;
+
+/* A global name native code relies on: a builtin, or another native */
+typedef struct {
+    const char* name;
+    struct LNATIVE* native;
+} LDEP;
+
+/*
+ * A function compiled ahead of time to C on unboxed longs. It stands
+ * in for the lambda it was compiled from while every name it relies
+ * on is still bound the way it was when compiled.
+ */
+typedef struct LNATIVE {
+    const char* name;
+    int arity;
+    long (*entry)(long* args);
+    LDEP* deps;             /* ending with a NULL name */
+
+    /* Filled in when attached */
+    int ndeps;
+    char** syms;
+    unsigned* versions;
+} LNATIVE;
+
+/* Native code gives up by jumping back here, to be interpreted instead */
+extern jmp_buf laot_bail;
+
+extern long laot_depth;
+
+static inline _Noreturn void laot_fail(void) {
+    longjmp(laot_bail, 1);
+}
+
+static inline void laot_enter(void) {
+    if (++laot_depth > LAOT_MAX_DEPTH) { laot_fail(); }
+}
+
+static inline long laot_add(long x, long y) {
+    long r;
+    if (__builtin_add_overflow(x, y, &r)) { laot_fail(); }
+    return r;
+}
+
+static inline long laot_sub(long x, long y) {
+    long r;
+    if (__builtin_sub_overflow(x, y, &r)) { laot_fail(); }
+    return r;
+}
+
+static inline long laot_mul(long x, long y) {
+    long r;
+    if (__builtin_mul_overflow(x, y, &r)) { laot_fail(); }
+    return r;
+}
+
+static inline long laot_div(long x, long y) {
+    if (y == 0 || (x == LONG_MIN && y == -1)) { laot_fail(); }
+    return x / y;
+}
+
+static inline long laot_mod(long x, long y) {
+    if (y == 0 || (x == LONG_MIN && y == -1)) { laot_fail(); }
+    return x % y;
+}
+
+static inline long laot_neg(long x) {
+    if (x == LONG_MIN) { laot_fail(); }
+    return -x;
+}
+
+/* Runtime of compiled programs */
+LENV* laot_start(void);
+int   laot_finish(LENV* e);
+LVAL* laot_list(int type, int count, ...);
+void  laot_attach(LENV* e, LNATIVE* n, LVAL* formals, LVAL* body);
+LVAL* laot_call(LVAL* f, LVAL* a);
+
+/* Compiler */
+int   laot_compile(char* out, char** files, int nfiles);
+
+#endif
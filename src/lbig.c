@@ -0,0 +1,486 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "lbig.h"
+
+/*
+ * Magnitudes are plain limb arrays with a length. The helpers below
+ * leave allocation to their callers, and don't mind leading zeros
+ * unless they say so.
+ */
+
+typedef uint32_t limb;
+
+/* r += a, with a no longer than r; returns the carry out of r */
+static limb add_in(limb* r, int nr, const limb* a, int na) {
+    uint64_t c = 0;
+    int i = 0;
+    for (; i < na; i++) {
+        c += (uint64_t)r[i] + a[i];
+        r[i] = (limb)c;
+        c >>= 32;
+    }
+    for (; c && i < nr; i++) {
+        c += r[i];
+        r[i] = (limb)c;
+        c >>= 32;
+    }
+    return (limb)c;
+}
+
+/* r -= a, with a no greater than r */
+static void sub_in(limb* r, int nr, const limb* a, int na) {
+    int64_t b = 0;
+    int i = 0;
+    for (; i < na; i++) {
+        b += (int64_t)r[i] - a[i];
+        r[i] = (limb)b;
+        b >>= 32;
+    }
+    for (; b && i < nr; i++) {
+        b += r[i];
+        r[i] = (limb)b;
+        b >>= 32;
+    }
+}
+
+/* Length without leading zeros */
+static int trim(const limb* a, int n) {
+    while (n > 0 && a[n-1] == 0) { n--; }
+    return n;
+}
+
+/* Compare trimmed magnitudes */
+static int mag_cmp(const limb* a, int na, const limb* b, int nb) {
+    if (na != nb) { return na < nb ? -1 : 1; }
+    for (int i = na - 1; i >= 0; i--) {
+        if (a[i] != b[i]) { return a[i] < b[i] ? -1 : 1; }
+    }
+    return 0;
+}
+
+/* r = a * b by rows, r having na + nb limbs */
+static void mul_school(limb* r, const limb* a, int na, const limb* b, int nb) {
+    memset(r, 0, sizeof(limb) * (na + nb));
+    for (int j = 0; j < nb; j++) {
+        uint64_t c = 0;
+        for (int i = 0; i < na; i++) {
+            c += (uint64_t)a[i] * b[j] + r[i + j];
+            r[i + j] = (limb)c;
+            c >>= 32;
+        }
+        r[j + na] = (limb)c;
+    }
+}
+
+/*
+ * r = a * b, r having na + nb limbs and na >= nb. Karatsuba splits
+ * both in halves, and gets by with three half-sized products instead
+ * of four: a0*b0, a1*b1, and (a0+a1)*(b0+b1) less the other two.
+ */
+static void mag_mul(limb* r, const limb* a, int na, const limb* b, int nb) {
+    if (nb < LBIG_KARATSUBA) {
+        mul_school(r, a, na, b, nb);
+        return;
+    }
+
+    int h = (na + 1) / 2;
+
+    /* Much shorter b: multiply it by a a piece at a time */
+    if (nb <= h) {
+        limb* t = malloc(sizeof(limb) * 2 * nb);
+        memset(r, 0, sizeof(limb) * (na + nb));
+        for (int i = 0; i < na; i += nb) {
+            int k = na - i < nb ? na - i : nb;
+            if (k == nb) { mag_mul(t, a + i, k, b, nb); }
+            else { mag_mul(t, b, nb, a + i, k); }
+            add_in(r + i, na + nb - i, t, k + nb);
+        }
+        free(t);
+        return;
+    }
+
+    int na1 = na - h, nb1 = nb - h;
+    mag_mul(r, a, h, b, h);
+    mag_mul(r + 2*h, a + h, na1, b + h, nb1);
+
+    limb* s1 = malloc(sizeof(limb) * 4 * (h + 1));
+    limb* s2 = s1 + (h + 1);
+    limb* z1 = s2 + (h + 1);
+
+    memcpy(s1, a, sizeof(limb) * h);
+    s1[h] = add_in(s1, h, a + h, na1);
+    memcpy(s2, b, sizeof(limb) * h);
+    s2[h] = add_in(s2, h, b + h, nb1);
+
+    mag_mul(z1, s1, h + 1, s2, h + 1);
+    sub_in(z1, 2*h + 2, r, 2*h);
+    sub_in(z1, 2*h + 2, r + 2*h, na1 + nb1);
+    add_in(r + h, na + nb - h, z1, trim(z1, 2*h + 2));
+
+    free(s1);
+}
+
+/* q = a / d, returning the remainder; q may be a */
+static limb div_small(limb* q, const limb* a, int na, limb d) {
+    uint64_t rem = 0;
+    for (int i = na - 1; i >= 0; i--) {
+        rem = (rem << 32) | a[i];
+        q[i] = (limb)(rem / d);
+        rem %= d;
+    }
+    return (limb)rem;
+}
+
+/*
+ * q = u / v and r = u % v by long division, Knuth's algorithm D. v is
+ * trimmed with at least two limbs, u at least as long; q needs
+ * nu - nv + 1 limbs and r nv.
+ */
+static void mag_divmod(limb* q, limb* r, const limb* u, int nu, const limb* v, int nv) {
+    int s = __builtin_clz(v[nv-1]);
+    limb* un = malloc(sizeof(limb) * (nu + 1 + nv));
+    limb* vn = un + nu + 1;
+
+    /* Shift v so its top bit is set, and u along with it */
+    for (int i = nv - 1; i > 0; i--) {
+        vn[i] = (limb)((((uint64_t)v[i] << 32) | v[i-1]) >> (32 - s));
+    }
+    vn[0] = v[0] << s;
+    un[nu] = (limb)(((uint64_t)u[nu-1] << s) >> 32);
+    for (int i = nu - 1; i > 0; i--) {
+        un[i] = (limb)((((uint64_t)u[i] << 32) | u[i-1]) >> (32 - s));
+    }
+    un[0] = u[0] << s;
+
+    for (int j = nu - nv; j >= 0; j--) {
+        /* Estimate the next digit from the top two, off by two at most */
+        uint64_t num = ((uint64_t)un[j+nv] << 32) | un[j+nv-1];
+        uint64_t qhat = num / vn[nv-1];
+        uint64_t rhat = num % vn[nv-1];
+        while (qhat >> 32 ||
+               qhat * vn[nv-2] > ((rhat << 32) | un[j+nv-2])) {
+            qhat--;
+            rhat += vn[nv-1];
+            if (rhat >> 32) { break; }
+        }
+
+        /* Subtract qhat * v */
+        int64_t t;
+        int64_t k = 0;
+        for (int i = 0; i < nv; i++) {
+            uint64_t p = qhat * vn[i];
+            t = (int64_t)un[i+j] - k - (int64_t)(p & 0xFFFFFFFF);
+            un[i+j] = (limb)t;
+            k = (int64_t)(p >> 32) - (t >> 32);
+        }
+        t = (int64_t)un[j+nv] - k;
+        un[j+nv] = (limb)t;
+
+        /* One too many: add v back */
+        q[j] = (limb)qhat;
+        if (t < 0) {
+            q[j]--;
+            uint64_t c = 0;
+            for (int i = 0; i < nv; i++) {
+                c += (uint64_t)un[i+j] + vn[i];
+                un[i+j] = (limb)c;
+                c >>= 32;
+            }
+            un[j+nv] += (limb)c;
+        }
+    }
+
+    for (int i = 0; i < nv; i++) {
+        r[i] = (limb)((((uint64_t)un[i+1] << 32) | un[i]) >> s);
+    }
+    free(un);
+}
+
+/* Any number as a sign and magnitude, without allocating for longs */
+typedef struct {
+    int sign;           /* -1, 0 or 1 */
+    int n;
+    const limb* d;
+    limb buf[2];
+} LBIG_VIEW;
+
+static void view(LBIG_VIEW* v, LVAL* x) {
+    if (ltype(x) == LVAL_BIG) {
+        v->sign = x->big->sign;
+        v->n = x->big->count;
+        v->d = x->big->d;
+        return;
+    }
+
+    long l = lnum(x);
+    unsigned long m = l < 0 ? 0UL - (unsigned long)l : (unsigned long)l;
+    v->sign = l < 0 ? -1 : l > 0;
+    v->n = 0;
+    while (m) {
+        v->buf[v->n++] = (limb)m;
+        m = m >> 16 >> 16;
+    }
+    v->d = v->buf;
+}
+
+/* The number with a given sign and magnitude, as a long if it fits */
+static LVAL* make(int sign, const limb* d, int n) {
+    n = trim(d, n);
+    if (n * 32 <= (int)sizeof(unsigned long) * CHAR_BIT) {
+        unsigned long m = 0;
+        for (int i = n - 1; i >= 0; i--) { m = (m << 16 << 16) | d[i]; }
+        if (sign > 0 && m <= (unsigned long)LONG_MAX) { return lval_num((long)m); }
+        if (sign < 0 && m <= (unsigned long)LONG_MAX + 1) {
+            return lval_num(m == (unsigned long)LONG_MAX + 1 ? LONG_MIN : -(long)m);
+        }
+        if (m == 0) { return lval_num(0); }
+    }
+
+    LBIG* b = lalloc(lbig_size(n));
+    b->sign = sign;
+    b->count = n;
+    memcpy(b->d, d, sizeof(limb) * n);
+    return lval_big(b);
+}
+
+/* Sum of x and y, with y's sign flipped for a difference */
+static LVAL* add(LVAL* x, LVAL* y, int flip) {
+    LBIG_VIEW a, b;
+    view(&a, x);
+    view(&b, y);
+    b.sign *= flip;
+
+    if (b.sign == 0) { return make(a.sign, a.d, a.n); }
+    if (a.sign == 0) { return make(b.sign, b.d, b.n); }
+
+    /* Larger magnitude first */
+    LBIG_VIEW* p = &a;
+    LBIG_VIEW* q = &b;
+    int c = mag_cmp(a.d, a.n, b.d, b.n);
+    if (c < 0) { p = &b; q = &a; }
+
+    limb* r = malloc(sizeof(limb) * (p->n + 1));
+    memcpy(r, p->d, sizeof(limb) * p->n);
+    LVAL* v;
+    if (a.sign == b.sign) {
+        r[p->n] = add_in(r, p->n, q->d, q->n);
+        v = make(p->sign, r, p->n + 1);
+    } else {
+        sub_in(r, p->n, q->d, q->n);
+        v = make(p->sign, r, p->n);
+    }
+    free(r);
+    return v;
+}
+
+LVAL* lbig_add(LVAL* x, LVAL* y) {
+    return add(x, y, 1);
+}
+
+LVAL* lbig_sub(LVAL* x, LVAL* y) {
+    return add(x, y, -1);
+}
+
+/* x0 + x1 + ..., or x0 - x1 - ..., in one buffer rather than a value a step */
+LVAL* lbig_sum(LVAL** v, int n, int sub) {
+    LBIG_VIEW a;
+    view(&a, v[0]);
+    int sign = a.sign;
+    int len = a.n;
+    int cap = a.n + 2;
+    limb* d = malloc(sizeof(limb) * cap);
+    limb* t = malloc(sizeof(limb) * cap);
+    memcpy(d, a.d, sizeof(limb) * a.n);
+
+    for (int i = 1; i < n; i++) {
+        LBIG_VIEW b;
+        view(&b, v[i]);
+        if (sub) { b.sign = -b.sign; }
+        if (b.sign == 0) { continue; }
+
+        int need = (b.n > len ? b.n : len) + 1;
+        if (need > cap) {
+            cap = need > 2 * cap ? need : 2 * cap;
+            d = realloc(d, sizeof(limb) * cap);
+            t = realloc(t, sizeof(limb) * cap);
+        }
+
+        if (sign == b.sign || sign == 0) {
+            if (b.n > len) {
+                memset(d + len, 0, sizeof(limb) * (b.n - len));
+                len = b.n;
+            }
+            limb c = add_in(d, len, b.d, b.n);
+            if (c) { d[len++] = c; }
+            sign = b.sign;
+        } else if (mag_cmp(d, len, b.d, b.n) >= 0) {
+            sub_in(d, len, b.d, b.n);
+            len = trim(d, len);
+            if (len == 0) { sign = 0; }
+        } else {
+            /* The difference changes sign */
+            memcpy(t, b.d, sizeof(limb) * b.n);
+            sub_in(t, b.n, d, len);
+            limb* u = d; d = t; t = u;
+            len = trim(d, b.n);
+            sign = b.sign;
+        }
+    }
+
+    LVAL* r = make(sign, d, len);
+    free(d);
+    free(t);
+    return r;
+}
+
+LVAL* lbig_neg(LVAL* x) {
+    return add(lval_fixnum(0), x, -1);
+}
+
+LVAL* lbig_mul(LVAL* x, LVAL* y) {
+    LBIG_VIEW a, b;
+    view(&a, x);
+    view(&b, y);
+    if (a.sign == 0 || b.sign == 0) { return lval_num(0); }
+    if (a.n < b.n) { view(&a, y); view(&b, x); }
+
+    limb* r = malloc(sizeof(limb) * (a.n + b.n));
+    mag_mul(r, a.d, a.n, b.d, b.n);
+    LVAL* v = make(a.sign * b.sign, r, a.n + b.n);
+    free(r);
+    return v;
+}
+
+/* Truncating division, leaving the remainder with the dividend's sign */
+static LVAL* divmod(LVAL* x, LVAL* y, int mod) {
+    LBIG_VIEW a, b;
+    view(&a, x);
+    view(&b, y);
+    if (b.sign == 0) { return lval_err("Division by zero"); }
+
+    if (mag_cmp(a.d, a.n, b.d, b.n) < 0) {
+        return mod ? make(a.sign, a.d, a.n) : lval_num(0);
+    }
+
+    limb* q = malloc(sizeof(limb) * (a.n + b.n + 1));
+    limb* r = q + a.n + 1;
+    if (b.n == 1) {
+        r[0] = div_small(q, a.d, a.n, b.d[0]);
+    } else {
+        mag_divmod(q, r, a.d, a.n, b.d, b.n);
+    }
+
+    LVAL* v = mod ? make(a.sign, r, b.n)
+                  : make(a.sign * b.sign, q, a.n - b.n + 1);
+    free(q);
+    return v;
+}
+
+LVAL* lbig_div(LVAL* x, LVAL* y) {
+    return divmod(x, y, 0);
+}
+
+LVAL* lbig_mod(LVAL* x, LVAL* y) {
+    return divmod(x, y, 1);
+}
+
+int lbig_cmp(LVAL* x, LVAL* y) {
+    LBIG_VIEW a, b;
+    view(&a, x);
+    view(&b, y);
+    if (a.sign != b.sign) { return a.sign < b.sign ? -1 : 1; }
+    int c = mag_cmp(a.d, a.n, b.d, b.n);
+    return a.sign < 0 ? -c : c;
+}
+
+/* Decimal digits, with an optional minus sign */
+LVAL* lbig_parse(char* s) {
+    int sign = 1;
+    if (*s == '-') { sign = -1; s++; }
+
+    /* Nine digits at a time, as one limb holds them */
+    int len = strlen(s);
+    limb* d = calloc(len / 9 + 2, sizeof(limb));
+    int n = 0;
+    for (int i = 0, k = len % 9 ? len % 9 : 9; i < len; i += k, k = 9) {
+        limb chunk = 0;
+        for (int j = 0; j < k; j++) { chunk = chunk * 10 + (s[i+j] - '0'); }
+
+        uint64_t c = chunk;
+        for (int j = 0; j < n; j++) {
+            c += (uint64_t)d[j] * 1000000000;
+            d[j] = (limb)c;
+            c >>= 32;
+        }
+        if (c) { d[n++] = (limb)c; }
+    }
+
+    LVAL* v = make(sign, d, n);
+    free(d);
+    return v;
+}
+
+/* Decimal digits, to be freed by the caller */
+char* lbig_str(LBIG* b) {
+    /* Nine digits at a time, least significant first */
+    int n = b->count;
+    limb* q = malloc(sizeof(limb) * n);
+    limb* chunks = malloc(sizeof(limb) * (n * 32 / 29 + 2));
+    int nchunks = 0;
+    memcpy(q, b->d, sizeof(limb) * n);
+    do {
+        chunks[nchunks++] = div_small(q, q, n, 1000000000);
+        n = trim(q, n);
+    } while (n > 0);
+
+    char* s = malloc(nchunks * 9 + 2);
+    char* p = s;
+    if (b->sign < 0) { *p++ = '-'; }
+    p += sprintf(p, "%u", chunks[nchunks-1]);
+    for (int i = nchunks - 2; i >= 0; i--) {
+        p += sprintf(p, "%09u", chunks[i]);
+    }
+
+    free(chunks);
+    free(q);
+    return s;
+}
+
+LBIG* lbig_copy(LBIG* b) {
+    LBIG* c = lalloc(lbig_size(b->count));
+    memcpy(c, b, lbig_size(b->count));
+    return c;
+}
+
+void lbig_free(LBIG* b) {
+    lfree(b, lbig_size(b->count));
+}
+
+int lbig_eq(LBIG* x, LBIG* y) {
+    return x->sign == y->sign && x->count == y->count &&
+           memcmp(x->d, y->d, sizeof(limb) * x->count) == 0;
+}
+
+/* The integer a whole, finite double stands for, exactly */
+LVAL* lbig_of_double(double x) {
+    limb d[DBL_MAX_EXP / 32 + 1];
+    int n = 0;
+    for (double m = fabs(x); m > 0; n++) {
+        double r = fmod(m, 4294967296.0);
+        d[n] = (limb)r;
+        m = (m - r) / 4294967296.0;
+    }
+    return make(x < 0 ? -1 : 1, d, n);
+}
+
+/* As a double, rounded from the top three limbs */
+double lbig_double(LBIG* b) {
+    double x = 0;
+    int low = b->count > 3 ? b->count - 3 : 0;
+    for (int i = b->count - 1; i >= low; i--) { x = x * 4294967296.0 + b->d[i]; }
+    return b->sign * ldexp(x, 32 * low);
+}
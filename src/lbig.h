@@ -0,0 +1,46 @@
+#ifndef lbig_h
+#define lbig_h
+
+#include <stdint.h>
+
+#include "lval.h"
+
+/* Limbs from which multiplication splits its operands in halves */
+#define LBIG_KARATSUBA 32
+
+/*
+ * Magnitude of an integer too big for a long, in base 2^32 limbs,
+ * least significant first. The top limb is never zero.
+ */
+typedef struct LBIG {
+    int sign;           /* 1 or -1 */
+    int count;
+    uint32_t d[];
+} LBIG;
+
+static inline size_t lbig_size(int count) {
+    return sizeof(LBIG) + sizeof(uint32_t) * count;
+}
+
+LVAL* lbig_parse(char* s);
+char* lbig_str(LBIG* b);
+LBIG* lbig_copy(LBIG* b);
+void  lbig_free(LBIG* b);
+int   lbig_eq(LBIG* x, LBIG* y);
+double lbig_double(LBIG* b);
+LVAL* lbig_of_double(double x);
+
+/*
+ * Arithmetic on any two numbers, big or not. The operands are left
+ * alone, and the result is only big if it doesn't fit in a long.
+ */
+LVAL* lbig_add(LVAL* x, LVAL* y);
+LVAL* lbig_sub(LVAL* x, LVAL* y);
+LVAL* lbig_mul(LVAL* x, LVAL* y);
+LVAL* lbig_div(LVAL* x, LVAL* y);
+LVAL* lbig_mod(LVAL* x, LVAL* y);
+LVAL* lbig_neg(LVAL* x);
+LVAL* lbig_sum(LVAL** v, int n, int sub);
+int   lbig_cmp(LVAL* x, LVAL* y);
+
+#endif
@@ -1,79 +1,225 @@
 #include "lenv.h"
 #include "lval.h"
+#include "lgc.h"
 
 /* Lisp environments (scopes) */
 
+static struct {
+    unsigned long local_hits;
+    unsigned long local_misses;
+    unsigned long global_hits;
+    unsigned long global_misses;
+} stats;
+
 /* Env constructor */
 LENV* lenv_new(void) {
-    LENV* e = malloc(sizeof(LENV));
+    LENV* e = lalloc_kind(LALLOC_ENV, sizeof(LENV));
     e->parent = NULL;
     e->count = 0;
     e->syms = NULL;
     e->vals = NULL;
+    e->cap = 0;
+    e->index = NULL;
     return e;
 }
 
+/* Symbols are interned, so the pointer is as good a key as the name */
+static int lenv_hash(char* sym, int cap) {
+    return (((uintptr_t)sym >> 3) * 11400714819323198485ull) & (cap - 1);
+}
+
+static void lenv_index_add(LENV* e, int i) {
+    int h = lenv_hash(e->syms[i], e->cap);
+    while (e->index[h]) { h = (h + 1) & (e->cap - 1); }
+    e->index[h] = i + 1;
+}
+
+/* Size the index for the current bindings, or drop it if they're few */
+static void lenv_reindex(LENV* e) {
+    int cap = 0;
+    if (e->count > LENV_LINEAR) {
+        cap = 16;
+        while (cap < 2 * e->count) { cap *= 2; }
+    }
+
+    lfree(e->index, sizeof(int) * e->cap);
+    e->cap = cap;
+    e->index = NULL;
+    if (!cap) { return; }
+
+    e->index = lalloc(sizeof(int) * cap);
+    memset(e->index, 0, sizeof(int) * cap);
+    for (int i = 0; i < e->count; i++) { lenv_index_add(e, i); }
+}
+
+/* Position of a binding in this env alone, or -1 */
+static int lenv_find(LENV* e, char* sym) {
+    if (!e->index) {
+        for (int i = 0; i < e->count; i++) {
+            if (e->syms[i] == sym) { return i; }
+        }
+        return -1;
+    }
+
+    int h = lenv_hash(sym, e->cap);
+    while (e->index[h]) {
+        int i = e->index[h] - 1;
+        if (e->syms[i] == sym) { return i; }
+        h = (h + 1) & (e->cap - 1);
+    }
+    return -1;
+}
+
 /* Copy constructor */
 LENV* lenv_copy(LENV* e) {
-    LENV* n = malloc(sizeof(LENV));
+    LENV* n = lenv_new();
     n->parent = e->parent;
     n->count = e->count;
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(LVAL*) * n->count);
+    n->syms = lalloc(sizeof(char*) * n->count);
+    n->vals = lalloc(sizeof(LVAL*) * n->count);
     for (int i = 0; i < e->count; i++) {
-        n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(n->syms[i], e->syms[i]);
-        n->vals[i] = lval_copy(e->vals[i]);
+        n->syms[i] = e->syms[i];
+        n->vals[i] = lval_ref(e->vals[i]);
+        lsym_bind(n->syms[i]);
     }
+    if (e->index) { lenv_reindex(n); }
     return n;
 }
 
+/* A new env binding each name to its value, taking the values over */
+LENV* lenv_frame(char** syms, LVAL** vals, int n) {
+    LENV* e = lenv_new();
+    e->count = n;
+    e->syms = lalloc(sizeof(char*) * n);
+    e->vals = lalloc(sizeof(LVAL*) * n);
+    memcpy(e->syms, syms, sizeof(char*) * n);
+    memcpy(e->vals, vals, sizeof(LVAL*) * n);
+    for (int i = 0; i < n; i++) { lsym_bind(syms[i]); }
+
+    if (n > LENV_LINEAR) { lenv_reindex(e); }
+    return e;
+}
+
 /* Env destructor */
 void lenv_del(LENV* e) {
     for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
+        lsym_unbind(e->syms[i]);
         lval_del(e->vals[i]);
     }
-    free(e->syms);
-    free(e->vals);
-    free(e);
+    lfree(e->syms, sizeof(char*) * e->count);
+    lfree(e->vals, sizeof(LVAL*) * e->count);
+    lfree(e->index, sizeof(int) * e->cap);
+    lfree_kind(LALLOC_ENV, e, sizeof(LENV));
 }
 
+/* Whether lenv_get can answer from the global cache, without the env */
+int lenv_cached(LVAL* k) {
+    return k->depth == LVAL_GLOBAL && k->version == lsym_of(k->sym)->version;
+}
+
+/**
+ * Look a symbol up by its resolved address first. Scoping is dynamic,
+ * so the address is only right when the frame that far up has the
+ * symbol in that slot and no frame on the way binds it.
+ *
+ * A global address is right for as long as the global binding is the
+ * only binding of the name anywhere, and the name's version says
+ * whether any binding has come, gone or changed since.
+ */
 LVAL* lenv_get(LENV* e, LVAL* k) {
-    for (int i = 0; i < e->count; i++) {
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            return lval_copy(e->vals[i]);
+    if (k->depth == LVAL_GLOBAL) {
+        if (k->version == lsym_of(k->sym)->version) {
+            stats.global_hits++;
+            return lval_ref(k->global->vals[k->slot]);
         }
-    }
+        stats.global_misses++;
+    } else if (k->depth >= 0) {
+        LENV* f = e;
+        int d = k->depth;
+        while (d > 0 && f && lenv_find(f, k->sym) < 0) { f = f->parent; d--; }
 
-    /* If no symbol found, check the ancestor tree */
-    if (e->parent) {
-        return lenv_get(e->parent, k);
+        if (d == 0 && f && k->slot < f->count && f->syms[k->slot] == k->sym) {
+            stats.local_hits++;
+            return lval_ref(f->vals[k->slot]);
+        }
+        stats.local_misses++;
     } else {
-        return lval_err("Unbound symbol '%s'", k->sym);
+        stats.global_misses++;
+    }
+
+    /* Otherwise search the chain, and remember where it was found */
+    for (int d = 0; e; e = e->parent, d++) {
+        int i = lenv_find(e, k->sym);
+        if (i < 0) { continue; }
+
+        if (e->parent) {
+            k->depth = d;
+            k->slot = i;
+        } else if (lsym_of(k->sym)->binds == 1) {
+            k->depth = LVAL_GLOBAL;
+            k->slot = i;
+            k->global = e;
+            k->version = lsym_of(k->sym)->version;
+        }
+        return lval_ref(e->vals[i]);
     }
+    return lval_err("Unbound symbol '%s'", k->sym);
 }
 
 void lenv_put(LENV* e, LVAL* k, LVAL* v) {
-    for (int i = 0; i < e->count; i++) {
-        /* If variable found, delete item at that position */
-        /* and replace with variable supplied by user */
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
-        }
+    /*
+     * Whatever is stored here lives as long as the env does, so an env
+     * outside the nursery only takes values tenured out of it
+     */
+    int tenure = !lalloc_in_region(e);
+    if (tenure) { lalloc_region_suspend(); }
+
+    /* If variable found, replace the value at that position */
+    int i = lenv_find(e, k->sym);
+    if (i >= 0) {
+        lsym_of(k->sym)->version++;
+        lval_del(e->vals[i]);
+        e->vals[i] = tenure ? lgc_tenure(v) : lval_ref(v);
+        if (tenure) { lalloc_region_resume(); }
+        return;
     }
 
     /* If no existing entry found, allocate space for new entry */
     e->count++;
-    e->vals = realloc(e->vals, sizeof(LVAL*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
+    e->vals = lrealloc(e, e->vals, sizeof(LVAL*) * (e->count-1),
+                       sizeof(LVAL*) * e->count);
+    e->syms = lrealloc(e, e->syms, sizeof(char*) * (e->count-1),
+                       sizeof(char*) * e->count);
+
+    /* Store the value and the interned symbol name */
+    e->vals[e->count - 1] = tenure ? lgc_tenure(v) : lval_ref(v);
+    e->syms[e->count - 1] = k->sym;
+    lsym_bind(k->sym);
+
+    /* Keep the index at most half full */
+    if (2 * e->count > e->cap && e->count > LENV_LINEAR) {
+        lenv_reindex(e);
+    } else if (e->index) {
+        lenv_index_add(e, e->count - 1);
+    }
+
+    if (tenure) { lalloc_region_resume(); }
+}
+
+/* Whether e binds every name that p does */
+int lenv_shadows(LENV* e, LENV* p) {
+    if (p->count > e->count) { return 0; }
+    for (int i = 0; i < p->count; i++) {
+        if (lenv_find(e, p->syms[i]) < 0) { return 0; }
+    }
+    return 1;
+}
 
-    /* Copy contents of LVAL and symbol string into new location */
-    e->vals[e->count - 1] = lval_copy(v);
-    e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
-    strcpy(e->syms[e->count - 1], k->sym);
+void lenv_print_stats(void) {
+    printf("local:  %lu hits, %lu misses\n",
+           stats.local_hits, stats.local_misses);
+    printf("global: %lu hits, %lu misses\n",
+           stats.global_hits, stats.global_misses);
 }
 
 /* Global "put" */
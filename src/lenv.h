@@ -7,20 +7,31 @@ struct LENV;
 struct LVAL;
 typedef struct LENV LENV;
 
+/* Envs with more bindings than this get a hash index over them */
+#define LENV_LINEAR 8
+
 struct LENV {
     LENV* parent;
     int count;
     char** syms;
     struct LVAL** vals;
+
+    /* Open-addressing index into syms/vals, slots hold position + 1 */
+    int cap;
+    int* index;
 };
 
 LENV* lenv_new(void);
 LENV* lenv_copy(LENV* e);
+LENV* lenv_frame(char** syms, struct LVAL** vals, int n);
 void  lenv_del(LENV* e);
 
+int   lenv_cached(struct LVAL* k);
 struct LVAL* lenv_get(LENV* e, struct LVAL* k);
 void lenv_put(LENV* e, struct LVAL* k, struct LVAL* v);
 
 void lenv_def(LENV* e, struct LVAL* k, struct LVAL* v);
+int  lenv_shadows(LENV* e, LENV* p);
+void lenv_print_stats(void);
 
 #endif
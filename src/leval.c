@@ -0,0 +1,218 @@
+#include "leval.h"
+#include "laot.h"
+
+/*
+ * Evaluator engines.
+ *
+ * The tree engine (lval_eval_tree) walks expressions and recurses on the
+ * C stack for arguments, so deep non-tail recursion runs out of stack.
+ * The stack engine evaluates the same way, but keeps what is left to do
+ * on a heap-allocated continuation stack instead: deep recursion costs
+ * heap, hits a depth limit with an ordinary error, and the evaluation
+ * could be stopped and picked up again between any two steps.
+ * The vm and closure engines walk like the tree engine but run lambda
+ * bodies as bytecode or as trees of C closures (see lvm.c).
+ */
+
+int  leval_engine = LEVAL_TREE;
+long leval_max_depth;   /* 0 for the engine's default */
+
+int leval_set_engine(char* name) {
+    if (strcmp(name, "tree")    == 0) { leval_engine = LEVAL_TREE;    return 1; }
+    if (strcmp(name, "stack")   == 0) { leval_engine = LEVAL_STACK;   return 1; }
+    if (strcmp(name, "vm")      == 0) { leval_engine = LEVAL_VM;      return 1; }
+    if (strcmp(name, "closure") == 0) { leval_engine = LEVAL_CLOSURE; return 1; }
+    return 0;
+}
+
+LVAL* leval_too_deep(void) {
+    long max = leval_max_depth ? leval_max_depth : LEVAL_STACK_DEPTH;
+    return lval_err("Maximum evaluation depth of %li exceeded.", max);
+}
+
+/* Continuations */
+
+enum {
+    LK_ARGS,    /* evaluating the elements of v in e, i done so far */
+    LK_FRAME    /* running the body of lambda v, released on return */
+};
+
+typedef struct {
+    int kind;
+    int i;
+    LVAL* v;
+    LENV* e;
+} LKONT;
+
+static LKONT* stack;
+static long top;
+static long cap;
+
+static int leval_push(int kind, LVAL* v, LENV* e) {
+    long max = leval_max_depth ? leval_max_depth : LEVAL_STACK_DEPTH;
+    if (top >= max) { return 0; }
+
+    if (top == cap) {
+        cap = cap ? 2 * cap : 256;
+        stack = realloc(stack, sizeof(LKONT) * cap);
+    }
+    stack[top++] = (LKONT){ kind, 0, v, e };
+    return 1;
+}
+
+void leval_cleanup(void) {
+    free(stack);
+    stack = NULL;
+    top = cap = 0;
+}
+
+/**
+ * Evaluate with the stack engine. Each round either evaluates v in e,
+ * or hands the result r to the innermost continuation. Nested calls
+ * from builtins (load, say) share the stack above their own base.
+ */
+LVAL* leval_stack(LENV* e, LVAL* v) {
+    long base = top;
+    LVAL* r = NULL;
+    int returning = 0;
+
+    while (1) {
+        if (!returning) {
+            if (ltype(v) == LVAL_SYM) {
+                r = lenv_get(e, v);
+                lval_del(v);
+                returning = 1;
+                continue;
+            }
+            if (ltype(v) != LVAL_SEXPR) {
+                r = v;
+                returning = 1;
+                continue;
+            }
+
+            v = lval_own(v);
+
+            /* Single and empty expressions */
+            if (v->count == 1) {
+                v = lval_take(v, 0);
+                continue;
+            }
+            if (v->count == 0) {
+                r = v;
+                returning = 1;
+                continue;
+            }
+
+            /* Evaluate the elements in turn, starting with the first */
+            if (!leval_push(LK_ARGS, v, e)) {
+                lval_del(v);
+                r = leval_too_deep();
+                break;
+            }
+            LVAL* x = v->cell[0];
+            v->cell[0] = lval_fixnum(0);
+            v = x;
+            continue;
+        }
+
+        if (top == base) { break; }
+        LKONT* k = &stack[top - 1];
+
+        /* The lambda is done with */
+        if (k->kind == LK_FRAME) {
+            lval_del(k->v);
+            top--;
+            continue;
+        }
+
+        /* Store the element, and move on to the next one if any */
+        k->v->cell[k->i++] = r;
+        if (k->i < k->v->count) {
+            e = k->e;
+            v = k->v->cell[k->i];
+            k->v->cell[k->i] = lval_fixnum(0);
+            returning = 0;
+            continue;
+        }
+
+        /* All evaluated, so apply */
+        v = k->v;
+        e = k->e;
+        top--;
+
+        int err = -1;
+        for (int i = 0; i < v->count && err < 0; i++) {
+            if (ltype(v->cell[i]) == LVAL_ERR) { err = i; }
+        }
+        if (err >= 0) {
+            r = lval_take(v, err);
+            continue;
+        }
+
+        LVAL* f = lval_pop(v, 0);
+        if (ltype(f) != LVAL_FUN) {
+            LVAL* x = lval_err(
+                "S-Expression starts with incorrect type. "
+                "Got %s, expected %s.",
+                ltype_name(ltype(f)), ltype_name(LVAL_FUN));
+            lval_del(f);
+            lval_del(v);
+            r = x;
+            continue;
+        }
+
+        /* if and eval go on to evaluate an expression in this env */
+        if (f->builtin == builtin_if || f->builtin == builtin_eval) {
+            v = f->builtin == builtin_if ? builtin_if_expr(e, v)
+                                         : builtin_eval_expr(e, v);
+            lval_del(f);
+            returning = 0;
+            continue;
+        }
+
+        if (f->builtin) {
+            r = f->builtin(e, v);
+            lval_del(f);
+            continue;
+        }
+
+        if (f->native) {
+            LVAL* x = laot_call(f, v);
+            if (x) {
+                r = x;
+                continue;
+            }
+        }
+
+        f = lval_bind(e, f, v);
+        if (ltype(f) == LVAL_ERR || f->formals->count) {
+            r = f;
+            continue;
+        }
+
+        /* Tail call: drop the finished frames the callee hides anyway */
+        f->env->parent = e;
+        while (top > base && stack[top - 1].kind == LK_FRAME &&
+               stack[top - 1].v->env == e && lenv_shadows(f->env, e)) {
+            e = e->parent;
+            f->env->parent = e;
+            lval_del(stack[--top].v);
+        }
+
+        if (!leval_push(LK_FRAME, f, NULL)) {
+            lval_del(f);
+            r = leval_too_deep();
+            break;
+        }
+        e = f->env;
+        v = lval_body(f);
+        returning = 0;
+    }
+
+    /* Out of depth: drop everything that was left to do */
+    while (top > base) {
+        lval_del(stack[--top].v);
+    }
+
+    return r;
+}
@@ -0,0 +1,26 @@
+#ifndef leval_h
+#define leval_h
+
+#include "lval.h"
+
+/* Evaluation engines, selected per run */
+enum {
+    LEVAL_TREE,
+    LEVAL_STACK,
+    LEVAL_VM,
+    LEVAL_CLOSURE
+};
+
+/* Continuations the stack engine allows unless told otherwise */
+#define LEVAL_STACK_DEPTH 10000000
+
+extern int  leval_engine;
+extern long leval_max_depth;
+
+int   leval_set_engine(char* name);
+void  leval_cleanup(void);
+LVAL* leval_too_deep(void);
+
+LVAL* leval_stack(struct LENV* e, LVAL* v);
+
+#endif
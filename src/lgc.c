@@ -0,0 +1,403 @@
+#include <time.h>
+
+#include "lgc.h"
+#include "lbig.h"
+#include "lvec.h"
+
+/*
+ * Generational collector.
+ *
+ * The young generation is the allocation region of the current
+ * top-level form: bump-allocated, and dropped wholesale when the form
+ * is done, which is the minor collection. Values that escape it are
+ * tenured into the slab heap at the write barriers in lenv_put and
+ * lval_add, so nothing old ever points at anything young.
+ *
+ * The old generation is collected by a full mark-sweep. Reference
+ * counting frees most values the moment they die, so this is a
+ * backstop: it finds heap values and envs that are no longer reachable
+ * from any root and reclaims them, and it reports what is live.
+ *
+ * Roots are the registered envs plus any object with references that no
+ * other heap object accounts for. Those come from the evaluation stack,
+ * C locals and region temporaries, which therefore never need to be
+ * registered one by one, and which makes a collection safe at any point
+ * between builtin calls.
+ */
+
+#define LGC_MIN_TRIGGER (1024 * 1024)
+
+typedef struct {
+    void* key;
+    void* forward;
+    int kind;
+    int refs;
+    int mark;
+} LGC_ENTRY;
+
+typedef struct {
+    LGC_ENTRY* entries;
+    size_t cap;
+    size_t count;
+} LGC_TABLE;
+
+static LENV** roots;
+static int nroots;
+
+static int auto_collect;
+static size_t next_trigger = LGC_MIN_TRIGGER;
+
+static struct {
+    unsigned long collections;
+    unsigned long freed;
+    size_t live_objects;
+    size_t live_bytes;
+    double last_pause;
+    double max_pause;
+    double total_pause;
+    unsigned long tenured;
+    size_t tenured_bytes;
+} stats;
+
+/**
+ * LISPY_GC=auto collects automatically between top-level forms once the
+ * heap outgrows its trigger. (gc ()) works either way.
+ */
+void lgc_init(void) {
+    char* env = getenv("LISPY_GC");
+    auto_collect = env && strcmp(env, "auto") == 0;
+}
+
+void lgc_cleanup(void) {
+    free(roots);
+    roots = NULL;
+    nroots = 0;
+}
+
+void lgc_root(LENV* e) {
+    roots = realloc(roots, sizeof(LENV*) * (nroots + 1));
+    roots[nroots++] = e;
+}
+
+void lgc_unroot(LENV* e) {
+    for (int i = 0; i < nroots; i++) {
+        if (roots[i] == e) {
+            roots[i] = roots[--nroots];
+            return;
+        }
+    }
+}
+
+/* Object table */
+
+static size_t lgc_hash(void* p, size_t cap) {
+    return (((uintptr_t)p >> 3) * 11400714819323198485ull) & (cap - 1);
+}
+
+static LGC_ENTRY* lgc_find(LGC_TABLE* t, void* p) {
+    if (!p || lval_is_fixnum(p) || t->cap == 0) { return NULL; }
+
+    size_t i = lgc_hash(p, t->cap);
+    while (t->entries[i].key) {
+        if (t->entries[i].key == p) { return &t->entries[i]; }
+        i = (i + 1) & (t->cap - 1);
+    }
+    return NULL;
+}
+
+static LGC_ENTRY* lgc_insert(LGC_TABLE* t, void* p, int kind, int refs) {
+    if (2 * (t->count + 1) > t->cap) {
+        LGC_TABLE n = { NULL, t->cap ? 2 * t->cap : 1024, 0 };
+        n.entries = calloc(n.cap, sizeof(LGC_ENTRY));
+        for (size_t i = 0; i < t->cap; i++) {
+            LGC_ENTRY* en = &t->entries[i];
+            if (en->key) { *lgc_insert(&n, en->key, en->kind, en->refs) = *en; }
+        }
+        free(t->entries);
+        *t = n;
+    }
+
+    size_t i = lgc_hash(p, t->cap);
+    while (t->entries[i].key) { i = (i + 1) & (t->cap - 1); }
+    t->entries[i] = (LGC_ENTRY){ p, NULL, kind, refs, 0 };
+    t->count++;
+    return &t->entries[i];
+}
+
+static void lgc_add_val(void* p, void* ctx) {
+    lgc_insert(ctx, p, LALLOC_VAL, ((LVAL*)p)->refs);
+}
+
+/* An env has exactly one owner, the lambda it belongs to */
+static void lgc_add_env(void* p, void* ctx) {
+    lgc_insert(ctx, p, LALLOC_ENV, 1);
+}
+
+/* Tracing */
+
+typedef void (*LGC_VISIT)(LGC_TABLE* t, void** slot, void* ctx);
+
+/* Visit the slots of an object that hold heap references */
+static void lgc_children(LGC_TABLE* t, LGC_ENTRY* en, LGC_VISIT fn, void* ctx) {
+    if (en->kind == LALLOC_ENV) {
+        LENV* e = en->key;
+        for (int i = 0; i < e->count; i++) { fn(t, (void**)&e->vals[i], ctx); }
+        return;
+    }
+
+    LVAL* v = en->key;
+    switch (v->type) {
+    case LVAL_FUN:
+        if (!v->builtin) {
+            fn(t, (void**)&v->env, ctx);
+            fn(t, (void**)&v->formals, ctx);
+            fn(t, (void**)&v->body, ctx);
+        }
+        break;
+
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+        if (lval_is_slice(v)) {
+            fn(t, (void**)&v->base, ctx);
+            break;
+        }
+        for (int i = 0; i < v->count; i++) { fn(t, (void**)&v->cell[i], ctx); }
+        break;
+    }
+}
+
+static void lgc_unref(LGC_TABLE* t, void** slot, void* ctx) {
+    LGC_ENTRY* en = lgc_find(t, *slot);
+    if (en) { en->refs--; }
+}
+
+typedef struct {
+    LGC_ENTRY** items;
+    size_t count;
+    size_t cap;
+} LGC_STACK;
+
+static void lgc_push(LGC_STACK* s, LGC_ENTRY* en) {
+    if (en->mark) { return; }
+    en->mark = 1;
+    if (s->count == s->cap) {
+        s->cap = s->cap ? 2 * s->cap : 256;
+        s->items = realloc(s->items, sizeof(LGC_ENTRY*) * s->cap);
+    }
+    s->items[s->count++] = en;
+}
+
+static void lgc_mark_child(LGC_TABLE* t, void** slot, void* ctx) {
+    LGC_ENTRY* en = lgc_find(t, *slot);
+    if (en) { lgc_push(ctx, en); }
+}
+
+/* Garbage children are cut loose so that freeing their parent skips them */
+static void lgc_detach(LGC_TABLE* t, void** slot, void* ctx) {
+    LGC_ENTRY* en = lgc_find(t, *slot);
+    if (en && !en->mark && en->kind == LALLOC_VAL) { *slot = lval_fixnum(0); }
+}
+
+static size_t lgc_size(LGC_ENTRY* en) {
+    if (en->kind == LALLOC_ENV) {
+        LENV* e = en->key;
+        return sizeof(LENV) + (sizeof(char*) + sizeof(LVAL*)) * e->count
+                            + sizeof(int) * e->cap;
+    }
+
+    LVAL* v = en->key;
+    size_t size = lval_size(v->type);
+    switch (v->type) {
+    case LVAL_STR: size += strlen(v->str) + 1; break;
+    case LVAL_BIG: size += lbig_size(v->big->count); break;
+    case LVAL_VEC: size += lvec_size(v->vec->count); break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR: size += lval_is_slice(v) ? 0 : sizeof(LVAL*) * v->cap; break;
+    }
+    return size;
+}
+
+/**
+ * Run a full collection and return the number of values freed.
+ * Does nothing unless the slab allocator is in use.
+ */
+size_t lgc_collect(void) {
+    if (lalloc_mode() != LALLOC_SLAB) { return 0; }
+
+    clock_t start = clock();
+
+    /* Every heap object, with all of its references */
+    LGC_TABLE t = { NULL, 0, 0 };
+    lalloc_walk(LALLOC_VAL, lgc_add_val, &t);
+    lalloc_walk(LALLOC_ENV, lgc_add_env, &t);
+
+    for (int i = 0; i < nroots; i++) {
+        LGC_ENTRY* en = lgc_find(&t, roots[i]);
+        if (en) { en->refs++; }
+    }
+
+    /* Subtract the references held by other heap objects */
+    for (size_t i = 0; i < t.cap; i++) {
+        if (t.entries[i].key) { lgc_children(&t, &t.entries[i], lgc_unref, NULL); }
+    }
+
+    /* What's left over is held from outside, so it's a root */
+    LGC_STACK stack = { NULL, 0, 0 };
+    for (size_t i = 0; i < t.cap; i++) {
+        if (t.entries[i].key && t.entries[i].refs > 0) { lgc_push(&stack, &t.entries[i]); }
+    }
+
+    while (stack.count) {
+        LGC_ENTRY* en = stack.items[--stack.count];
+        lgc_children(&t, en, lgc_mark_child, &stack);
+    }
+    free(stack.items);
+
+    /* Sweep */
+    size_t live_objects = 0, live_bytes = 0, freed = 0;
+    for (size_t i = 0; i < t.cap; i++) {
+        LGC_ENTRY* en = &t.entries[i];
+        if (!en->key) { continue; }
+        if (en->mark) {
+            live_objects++;
+            live_bytes += lgc_size(en);
+        } else {
+            lgc_children(&t, en, lgc_detach, NULL);
+        }
+    }
+
+    /* Envs of dead lambdas go with them, so only values are freed here */
+    for (size_t i = 0; i < t.cap; i++) {
+        LGC_ENTRY* en = &t.entries[i];
+        if (en->key && !en->mark && en->kind == LALLOC_VAL) {
+            LVAL* v = en->key;
+            v->refs = 1;
+            lval_del(v);
+            freed++;
+        }
+    }
+    free(t.entries);
+
+    double pause = (double)(clock() - start) / CLOCKS_PER_SEC;
+    stats.collections++;
+    stats.freed += freed;
+    stats.live_objects = live_objects;
+    stats.live_bytes = live_bytes;
+    stats.last_pause = pause;
+    stats.total_pause += pause;
+    if (pause > stats.max_pause) { stats.max_pause = pause; }
+
+    size_t heap = lalloc_heap_bytes();
+    next_trigger = heap * 2 > LGC_MIN_TRIGGER ? heap * 2 : LGC_MIN_TRIGGER;
+
+    return freed;
+}
+
+/* Tenuring */
+
+typedef struct {
+    LGC_TABLE forward;
+    LVAL** grey;
+    size_t head;
+    size_t count;
+    size_t cap;
+} LGC_TENURE;
+
+/* Copy a young value into the old generation, once per value */
+static LVAL* lgc_evacuate(LGC_TENURE* t, LVAL* y) {
+    if (lval_is_fixnum(y) || !lalloc_in_region(y)) { return lval_ref(y); }
+
+    LGC_ENTRY* en = lgc_find(&t->forward, y);
+    if (en) { return lval_ref(en->forward); }
+
+    /*
+     * Children are still the young ones; the scan fixes them up. Slices
+     * come out of the copy with cells of their own.
+     */
+    LVAL* x = lval_copy(y);
+    lgc_insert(&t->forward, y, LALLOC_VAL, 0)->forward = x;
+
+    if (t->count == t->cap) {
+        t->cap = t->cap ? 2 * t->cap : 64;
+        t->grey = realloc(t->grey, sizeof(LVAL*) * t->cap);
+    }
+    t->grey[t->count++] = x;
+
+    stats.tenured++;
+    stats.tenured_bytes += lval_size(x->type);
+    return x;
+}
+
+static void lgc_evacuate_slot(LGC_TENURE* t, LVAL** slot) {
+    LVAL* y = *slot;
+    *slot = lgc_evacuate(t, y);
+    lval_del(y);
+}
+
+/**
+ * Get a reference to v that lives in the old generation. Young parts
+ * are evacuated breadth-first, Cheney style, with a forwarding table
+ * so that values shared within v stay shared; old parts are shared.
+ */
+LVAL* lgc_tenure(LVAL* v) {
+    if (lval_is_fixnum(v) || !lalloc_in_region(v)) { return lval_ref(v); }
+
+    lalloc_region_suspend();
+
+    LGC_TENURE t = { { NULL, 0, 0 }, NULL, 0, 0, 0 };
+    LVAL* x = lgc_evacuate(&t, v);
+
+    /* Scan copies until no young references are left */
+    while (t.head < t.count) {
+        LVAL* c = t.grey[t.head++];
+
+        switch (c->type) {
+        case LVAL_FUN:
+            if (!c->builtin) {
+                for (int i = 0; i < c->env->count; i++) {
+                    lgc_evacuate_slot(&t, &c->env->vals[i]);
+                }
+                lgc_evacuate_slot(&t, &c->formals);
+                lgc_evacuate_slot(&t, &c->body);
+            }
+            break;
+
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for (int i = 0; i < c->count; i++) {
+                lgc_evacuate_slot(&t, &c->cell[i]);
+            }
+            break;
+        }
+    }
+
+    free(t.forward.entries);
+    free(t.grey);
+
+    lalloc_region_resume();
+    return x;
+}
+
+/* Called where nothing is half-built, i.e. between top-level forms */
+void lgc_safepoint(void) {
+    if (auto_collect && lalloc_heap_bytes() > next_trigger) { lgc_collect(); }
+}
+
+void lgc_print_stats(void) {
+    LREGION_STATS minor = lalloc_region_stats();
+    printf("minor:        %lu collections, pause (ms) last %.3f, max %.3f\n",
+           minor.releases, minor.last_pause * 1000, minor.max_pause * 1000);
+    printf("tenured:      %lu values, %zu bytes\n",
+           stats.tenured, stats.tenured_bytes);
+
+    printf("collections:  %lu%s\n", stats.collections,
+           auto_collect ? " (auto)" : "");
+    printf("freed:        %lu values\n", stats.freed);
+    printf("live:         %zu objects, %zu bytes\n",
+           stats.live_objects, stats.live_bytes);
+    printf("heap:         %zu bytes, next collection at %zu\n",
+           lalloc_heap_bytes(), next_trigger);
+    printf("pause (ms):   last %.3f, max %.3f, total %.3f\n",
+           stats.last_pause * 1000, stats.max_pause * 1000,
+           stats.total_pause * 1000);
+}
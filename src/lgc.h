@@ -0,0 +1,16 @@
+#ifndef lgc_h
+#define lgc_h
+
+#include "lenv.h"
+
+void   lgc_init(void);
+void   lgc_cleanup(void);
+void   lgc_root(LENV* e);
+void   lgc_unroot(LENV* e);
+
+LVAL*  lgc_tenure(LVAL* v);
+size_t lgc_collect(void);
+void   lgc_safepoint(void);
+void   lgc_print_stats(void);
+
+#endif
@@ -2,9 +2,13 @@
 #define lispy_h
 
 #include "mpc.h"
+#include "lparse.h"
 #include "lenv.h"
 #include "lval.h"
 #include "builtin.h"
+#include "leval.h"
+#include "lvm.h"
+#include "laot.h"
 
 /* No history.h on OS X */
 #ifdef __APPLE__
@@ -14,13 +18,4 @@
 #include <editline/history.h>
 #endif
 
-mpc_parser_t* Number;
-mpc_parser_t* Symbol;
-mpc_parser_t* String;
-mpc_parser_t* Comment;
-mpc_parser_t* Sexpr;
-mpc_parser_t* Qexpr;
-mpc_parser_t* Expr;
-mpc_parser_t* Lispy;
-
 #endif
@@ -0,0 +1,480 @@
+#include "lopt.h"
+#include "lgc.h"
+#include "builtin.h"
+
+/*
+ * Constant folding and inlining of lambda bodies.
+ *
+ * When a lambda is made, calls to pure builtins on literal numbers are
+ * replaced by their results, and if on a constant condition by the
+ * branch it takes. Calls to small global lambdas are replaced by their
+ * bodies, with the arguments in place of the formals, when that can't
+ * be told apart from calling them: either the arguments are the
+ * caller's own bindings of the same names, or the body only calls
+ * builtins without effects and uses each argument expression once.
+ *
+ * Names are looked up dynamically, so this is only good while each name
+ * folded or inlined away still means what it did: each is guarded by
+ * the version of its symbol, and the original body is evaluated instead
+ * while any guard fails.
+ */
+
+typedef struct {
+    LENV* global;
+    LVAL* formals;
+    LOPT* o;
+    int capguards;
+    int folds;
+    int depth;          /* of inlined calls */
+} LFOLD;
+
+/* Builtins with no effects, whose results only depend on the arguments */
+static const LBUILTIN pure[] = {
+    builtin_add, builtin_sub, builtin_mul, builtin_div, builtin_mod,
+    builtin_lt, builtin_gt, builtin_le, builtin_ge, builtin_eq, builtin_ne,
+};
+
+/* Builtins with no effects at all, that an inlined body may call */
+static const LBUILTIN effectless[] = {
+    builtin_add, builtin_sub, builtin_mul, builtin_div, builtin_mod,
+    builtin_lt, builtin_gt, builtin_le, builtin_ge, builtin_eq, builtin_ne,
+    builtin_if, builtin_list, builtin_len, builtin_head, builtin_tail,
+    builtin_join, builtin_cons, builtin_reverse, builtin_take, builtin_drop,
+    builtin_split, builtin_zip, builtin_type,
+};
+
+#define COUNT(a) ((int)(sizeof(a) / sizeof(a[0])))
+
+static int is_in(LBUILTIN b, const LBUILTIN* set, int n) {
+    for (int i = 0; b && i < n; i++) {
+        if (set[i] == b) { return 1; }
+    }
+    return 0;
+}
+
+static int formal_of(LVAL* formals, char* sym) {
+    for (int i = 0; i < formals->count; i++) {
+        if (formals->cell[i]->sym == sym) { return i; }
+    }
+    return -1;
+}
+
+/* The function a global name is bound to, if it's bound nowhere else */
+static LVAL* global_fun(LFOLD* F, LVAL* x) {
+    if (ltype(x) != LVAL_SYM || lsym_of(x->sym)->binds != 1) { return NULL; }
+    if (formal_of(F->formals, x->sym) >= 0) { return NULL; }
+
+    LVAL* f = lenv_get(F->global, x);
+    if (ltype(f) == LVAL_FUN) { return f; }
+    lval_del(f);
+    return NULL;
+}
+
+static LBUILTIN global_builtin(LFOLD* F, LVAL* x) {
+    LVAL* f = global_fun(F, x);
+    LBUILTIN b = f ? f->builtin : NULL;
+    if (f) { lval_del(f); }
+    return b;
+}
+
+/* Guard on the name being bound to the builtin, or the lambda with this body */
+static void guard(LFOLD* F, LVAL* sym, LBUILTIN b, LVAL* body) {
+    LOPT* o = F->o;
+    for (int i = 0; i < o->nguards; i++) {
+        if (o->guards[i].sym->sym == sym->sym) { return; }
+    }
+
+    if (o->nguards == F->capguards) {
+        F->capguards = F->capguards ? 2 * F->capguards : 4;
+        o->guards = realloc(o->guards, sizeof(LOPT_GUARD) * F->capguards);
+    }
+
+    lalloc_region_suspend();
+    o->guards[o->nguards++] = (LOPT_GUARD){
+        lval_sym(sym->sym), b, body ? lval_ref(body) : NULL,
+        lsym_of(sym->sym)->version };
+    lalloc_region_resume();
+}
+
+/* Drop the guards taken since there were n */
+static void unguard(LFOLD* F, int n) {
+    LOPT* o = F->o;
+    while (o->nguards > n) {
+        LOPT_GUARD* g = &o->guards[--o->nguards];
+        lval_del(g->sym);
+        if (g->body) { lval_del(g->body); }
+    }
+}
+
+/* Inlining */
+
+typedef struct {
+    LFOLD* F;
+    LVAL* formals;      /* of the lambda inlined */
+    int uses[LOPT_INLINE_SIZE];
+    int unconditional[LOPT_INLINE_SIZE];
+    int evals;          /* branches not written out, that may see the formals */
+} LINLINE;
+
+static int size_of(LVAL* x, int limit) {
+    int size = 1;
+    if (ltype(x) == LVAL_SEXPR || ltype(x) == LVAL_QEXPR) {
+        for (int i = 0; i < x->count && size <= limit; i++) {
+            size += size_of(x->cell[i], limit);
+        }
+    }
+    return size;
+}
+
+/* Whether a list mentions none of the symbols, nor any named in names */
+static int mentions_none(LVAL* x, LVAL* formals, char** names, int n) {
+    switch (ltype(x)) {
+    case LVAL_SYM:
+        if (formals && formal_of(formals, x->sym) >= 0) { return 0; }
+        for (int i = 0; i < n; i++) {
+            if (strcmp(x->sym, names[i]) == 0) { return 0; }
+        }
+        return 1;
+
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+        for (int i = 0; i < x->count; i++) {
+            if (!mentions_none(x->cell[i], formals, names, n)) { return 0; }
+        }
+        return 1;
+    }
+    return 1;
+}
+
+static int scan_seq(LINLINE* S, LVAL* x, int cond);
+
+/* Count the uses of formals where they're evaluated; 0 if there's a call
+   the body can't be inlined with, or a formal used as data */
+static int scan(LINLINE* S, LVAL* x, int cond) {
+    switch (ltype(x)) {
+    case LVAL_SYM: {
+        int i = formal_of(S->formals, x->sym);
+        if (i >= 0) {
+            S->uses[i]++;
+            if (!cond) { S->unconditional[i]++; }
+        }
+        return 1;
+    }
+    case LVAL_SEXPR: return scan_seq(S, x, cond);
+    case LVAL_QEXPR: return mentions_none(x, S->formals, NULL, 0);
+    }
+    return 1;
+}
+
+static int scan_seq(LINLINE* S, LVAL* x, int cond) {
+    if (x->count == 0) { return 1; }
+    if (x->count == 1) { return scan(S, x->cell[0], cond); }
+
+    LVAL* h = x->cell[0];
+    if (ltype(h) != LVAL_SYM || formal_of(S->formals, h->sym) >= 0) { return 0; }
+
+    LBUILTIN b = global_builtin(S->F, h);
+    if (!is_in(b, effectless, COUNT(effectless))) { return 0; }
+    guard(S->F, h, b, NULL);
+
+    int branches = b == builtin_if && x->count == 4 &&
+        ltype(x->cell[2]) == LVAL_QEXPR && ltype(x->cell[3]) == LVAL_QEXPR;
+    if (b == builtin_if && !branches) { S->evals++; }
+
+    for (int i = 1; i < x->count; i++) {
+        int ok = branches && i >= 2 ? scan_seq(S, x->cell[i], 1)
+                                    : scan(S, x->cell[i], cond);
+        if (!ok) { return 0; }
+    }
+    return 1;
+}
+
+/* Whether evaluating the call's arguments in the body is as good as before */
+static int args_fit(LINLINE* S, LVAL* call) {
+    int exprs = 0;
+    for (int i = 0; i < S->formals->count; i++) {
+        LVAL* a = call->cell[i + 1];
+
+        /* Code passed in for if must not see the formals it would have */
+        if (S->evals && ltype(a) != LVAL_NUM && ltype(a) != LVAL_STR &&
+            !(ltype(a) == LVAL_QEXPR && mentions_none(a, S->formals, NULL, 0))) {
+            return 0;
+        }
+
+        switch (ltype(a)) {
+        case LVAL_NUM:
+        case LVAL_STR:
+        case LVAL_QEXPR:
+            break;
+
+        /* Looked up at least once, whatever happens */
+        case LVAL_SYM:
+            if (!S->unconditional[i]) { return 0; }
+            break;
+
+        /* Evaluated exactly once, and in the same order as the rest */
+        case LVAL_SEXPR:
+            if (S->uses[i] != 1 || S->unconditional[i] != 1) { return 0; }
+            if (++exprs > 1) { return 0; }
+            break;
+
+        default:
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static LVAL* substitute(LVAL* x, LVAL* formals, LVAL* call) {
+    if (ltype(x) == LVAL_SYM) {
+        int i = formal_of(formals, x->sym);
+        return lval_ref(i >= 0 ? call->cell[i + 1] : x);
+    }
+    if (ltype(x) != LVAL_SEXPR && ltype(x) != LVAL_QEXPR) { return lval_ref(x); }
+
+    LVAL* y = NULL;
+    for (int i = 0; i < x->count; i++) {
+        LVAL* c = substitute(x->cell[i], formals, call);
+        if (c != x->cell[i] && !y) {
+            y = ltype(x) == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+            for (int j = 0; j < i; j++) { lval_add(y, lval_ref(x->cell[j])); }
+        }
+        if (y) { lval_add(y, c); } else { lval_del(c); }
+    }
+    return y ? y : lval_ref(x);
+}
+
+static LVAL* fold(LFOLD* F, LVAL* x);
+
+/* The call with f's body in its place, or NULL if it can't be inlined */
+static LVAL* inline_call(LFOLD* F, LVAL* call, LVAL* f) {
+    LVAL* formals = f->formals;
+    if (f->builtin || f->env->count || formals->count != call->count - 1) { return NULL; }
+    if (formals->count > LOPT_INLINE_SIZE || F->depth == LOPT_INLINE_DEPTH) { return NULL; }
+
+    for (int i = 0; i < formals->count; i++) {
+        char* sym = formals->cell[i]->sym;
+        if (sym == lsym_amp || formal_of(formals, sym) != i) { return NULL; }
+    }
+
+    LVAL* body = lopt_body(f);
+    if (size_of(body, LOPT_INLINE_SIZE) > LOPT_INLINE_SIZE) { return NULL; }
+
+    /* Passed the caller's bindings of the same names, the body sees no difference */
+    int same = 1;
+    for (int i = 0; i < formals->count && same; i++) {
+        LVAL* a = call->cell[i + 1];
+        same = ltype(a) == LVAL_SYM && a->sym == formals->cell[i]->sym;
+    }
+
+    int nguards = F->o->nguards;
+    int ok;
+    if (same) {
+        /* Unless it binds in its own frame, or calls itself */
+        char* names[] = { call->cell[0]->sym, "=", "def" };
+        ok = mentions_none(body, NULL, names, COUNT(names));
+    } else {
+        LINLINE S = { F, formals, { 0 }, { 0 }, 0 };
+        ok = scan_seq(&S, body, 0) && args_fit(&S, call);
+    }
+    if (!ok) {
+        unguard(F, nguards);
+        return NULL;
+    }
+
+    guard(F, call->cell[0], NULL, f->body);
+    if (f->opt && body == f->opt->body) {
+        for (int i = 0; i < f->opt->nguards; i++) {
+            LOPT_GUARD* g = &f->opt->guards[i];
+            guard(F, g->sym, g->builtin, g->body);
+        }
+    }
+
+    /* The body as lval_body would run it */
+    LVAL* x = substitute(body, formals, call);
+    x = lval_own(x);
+    x->type = LVAL_SEXPR;
+
+    F->folds++;
+    F->depth++;
+    LVAL* y = fold(F, x);
+    F->depth--;
+    lval_del(x);
+    return y;
+}
+
+/* Folding */
+
+static LVAL* fold_seq(LFOLD* F, LVAL* x, int* kept);
+
+static LVAL* fold(LFOLD* F, LVAL* x) {
+    int kept;
+    return ltype(x) == LVAL_SEXPR ? fold_seq(F, x, &kept) : lval_ref(x);
+}
+
+/* A body or branch, folded, that is still one */
+static LVAL* fold_body(LFOLD* F, LVAL* x) {
+    int kept;
+    LVAL* y = fold_seq(F, x, &kept);
+    if (kept) { return y; }
+
+    /* What the whole body came to is run as its only element */
+    return lval_add(lval_qexpr(), y);
+}
+
+/*
+ * The elements of a list, folded as they would be evaluated as a sexpr.
+ * Sets kept if the result is still that list, elements folded, rather
+ * than an expression that replaces the whole of it.
+ */
+static LVAL* fold_seq(LFOLD* F, LVAL* x, int* kept) {
+    *kept = 1;
+    if (x->count == 0) { return lval_ref(x); }
+
+    /* (e) evaluates as e does, rather than calling it */
+    if (x->count == 1) {
+        LVAL* c = fold(F, x->cell[0]);
+        if (ltype(x) == LVAL_SEXPR || c != x->cell[0]) {
+            *kept = 0;
+            return c;
+        }
+        lval_del(c);
+        return lval_ref(x);
+    }
+
+    LVAL* f = global_fun(F, x->cell[0]);
+    LBUILTIN b = f ? f->builtin : NULL;
+
+    /* Lambdas written out in the body are folded when they are made */
+    if (b == builtin_lambda) {
+        lval_del(f);
+        return lval_ref(x);
+    }
+
+    /* (if c {then} {else}) goes into its branches */
+    int branches = b == builtin_if && x->count == 4 &&
+        ltype(x->cell[2]) == LVAL_QEXPR && ltype(x->cell[3]) == LVAL_QEXPR;
+    int folds = F->folds;
+
+    LVAL* y = NULL;
+    for (int i = 0; i < x->count; i++) {
+        LVAL* c = branches && i >= 2 ? fold_body(F, x->cell[i]) : fold(F, x->cell[i]);
+        if (c != x->cell[i] && !y) {
+            y = ltype(x) == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+            for (int j = 0; j < i; j++) { lval_add(y, lval_ref(x->cell[j])); }
+        }
+        if (y) { lval_add(y, c); } else { lval_del(c); }
+    }
+    if (!y) { y = lval_ref(x); }
+
+    if (f && !b) {
+        LVAL* r = inline_call(F, y, f);
+        lval_del(f);
+        if (r) {
+            lval_del(y);
+            *kept = 0;
+            return r;
+        }
+        return y;
+    }
+    if (f) { lval_del(f); }
+
+    /* A constant condition picks its branch; (e) evaluates as e does */
+    if (branches && ltype(y->cell[1]) == LVAL_NUM) {
+        LVAL* t = y->cell[lnum(y->cell[1]) ? 2 : 3];
+        LVAL* r = t->count == 1 ? lval_ref(t->cell[0]) : lval_copy(t);
+        if (t->count != 1) { r->type = LVAL_SEXPR; }
+        lval_del(y);
+        F->folds++;
+        guard(F, x->cell[0], b, NULL);
+        *kept = 0;
+        return r;
+    }
+
+    if (branches && F->folds != folds) { guard(F, x->cell[0], b, NULL); }
+
+    if (!is_in(b, pure, COUNT(pure)) || x->count < 2) { return y; }
+    for (int i = 1; i < y->count; i++) {
+        if (ltype(y->cell[i]) != LVAL_NUM) { return y; }
+    }
+
+    /* Errors such as division by zero are left to happen when called */
+    LVAL* a = lval_sexpr();
+    for (int i = 1; i < y->count; i++) { lval_add(a, lval_ref(y->cell[i])); }
+    LVAL* r = b(F->global, a);
+    if (ltype(r) != LVAL_NUM) {
+        lval_del(r);
+        return y;
+    }
+
+    lval_del(y);
+    F->folds++;
+    guard(F, x->cell[0], b, NULL);
+    *kept = 0;
+    return r;
+}
+
+/**
+ * Fold what can be folded in a lambda body. Returns NULL if nothing
+ * can, so that most lambdas cost nothing more to make.
+ */
+LOPT* lopt_fold(LENV* e, LVAL* formals, LVAL* body) {
+    LOPT* o = calloc(1, sizeof(LOPT));
+    o->refs = 1;
+    o->global = e;
+    while (o->global->parent) { o->global = o->global->parent; }
+
+    LFOLD F = { o->global, formals, o, 0, 0, 0 };
+    LVAL* y = fold_body(&F, body);
+
+    /* Guards are checked on entry, so the body mustn't rebind as it goes */
+    char* binders[] = { "def", "=", "load" };
+    if (!mentions_none(y, NULL, binders, COUNT(binders))) { F.folds = 0; }
+
+    if (F.folds) { o->body = lgc_tenure(y); }
+    lval_del(y);
+
+    if (!F.folds) {
+        lopt_release(o);
+        return NULL;
+    }
+    return o;
+}
+
+/* Whether the guarded name is still bound as it was, and only globally */
+static int guard_refresh(LOPT* o, LOPT_GUARD* g) {
+    LSYM* s = lsym_of(g->sym->sym);
+    LVAL* f = lenv_get(o->global, g->sym);
+    int holds = s->binds == 1 && ltype(f) == LVAL_FUN && f->builtin == g->builtin
+             && (g->builtin || f->body == g->body);
+    lval_del(f);
+
+    if (holds) { g->version = s->version; }
+    return holds;
+}
+
+/* The body to evaluate for a lambda: the folded one, while it's valid */
+LVAL* lopt_body(LVAL* f) {
+    LOPT* o = f->opt;
+    if (!o) { return f->body; }
+
+    for (int i = 0; i < o->nguards; i++) {
+        LOPT_GUARD* g = &o->guards[i];
+        if (lsym_of(g->sym->sym)->version != g->version && !guard_refresh(o, g)) {
+            return f->body;
+        }
+    }
+    return o->body;
+}
+
+void lopt_release(LOPT* o) {
+    if (!o || --o->refs > 0) { return; }
+
+    if (o->body) { lval_del(o->body); }
+    for (int i = 0; i < o->nguards; i++) {
+        lval_del(o->guards[i].sym);
+        if (o->guards[i].body) { lval_del(o->guards[i].body); }
+    }
+    free(o->guards);
+    free(o);
+}
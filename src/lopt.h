@@ -0,0 +1,34 @@
+#ifndef lopt_h
+#define lopt_h
+
+#include "lval.h"
+#include "lenv.h"
+
+/* Most values in a body for it to be inlined */
+#define LOPT_INLINE_SIZE 24
+
+/* Inlined calls within inlined calls, at most */
+#define LOPT_INLINE_DEPTH 4
+
+/* What a name folded or inlined away was bound to, and when that was seen */
+typedef struct {
+    LVAL* sym;
+    LBUILTIN builtin;   /* the builtin, or */
+    LVAL* body;         /* the body of the lambda */
+    unsigned version;
+} LOPT_GUARD;
+
+/* A lambda body with constant parts folded, shared by all copies */
+typedef struct LOPT {
+    int refs;
+    LVAL* body;
+    LENV* global;       /* where the guarded names are bound */
+    LOPT_GUARD* guards;
+    int nguards;
+} LOPT;
+
+LOPT* lopt_fold(LENV* e, LVAL* formals, LVAL* body);
+LVAL* lopt_body(LVAL* f);
+void  lopt_release(LOPT* o);
+
+#endif
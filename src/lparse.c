@@ -0,0 +1,45 @@
+#include "lparse.h"
+
+mpc_parser_t* Float;
+mpc_parser_t* Number;
+mpc_parser_t* Symbol;
+mpc_parser_t* String;
+mpc_parser_t* Comment;
+mpc_parser_t* Sexpr;
+mpc_parser_t* Qexpr;
+mpc_parser_t* Expr;
+mpc_parser_t* Lispy;
+
+void lparse_init(void) {
+    Float   = mpc_new("float");
+    Number  = mpc_new("number");
+    Symbol  = mpc_new("symbol");
+    String  = mpc_new("string");
+    Comment = mpc_new("comment");
+    Sexpr   = mpc_new("sexpr");
+    Qexpr   = mpc_new("qexpr");
+    Expr    = mpc_new("expr");
+    Lispy   = mpc_new("lispy");
+
+    mpca_lang(MPCA_LANG_DEFAULT,
+      "                                                  \
+      float  : /-?[0-9]+(\\.[0-9]+([eE][-+]?[0-9]+)?|[eE][-+]?[0-9]+)/ ; \
+      number : /-?[0-9]+/ ;                              \
+      symbol : /[a-zA-Z0-9_+\\-*%\\/\\\\=<>!\?&]+/ ;     \
+      string  : /\"(\\\\.|[^\"])*\"/ ;                   \
+      comment : /;[^\\r\\n]*/ ;                          \
+      sexpr  : '(' <expr>* ')' ;                         \
+      qexpr  : '{' <expr>* '}' ;                         \
+      expr   : <float>    | <number> | <symbol>          \
+             | <string>   | <comment>                    \
+             | <sexpr>    | <qexpr> ;                    \
+      lispy  : /^/ <expr>* /$/ ;                         \
+      ",
+      Float, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+}
+
+void lparse_cleanup(void) {
+    mpc_cleanup(9,
+        Float,  Number, Symbol, String, Comment,
+        Sexpr,  Qexpr,  Expr,   Lispy);
+}
@@ -0,0 +1,20 @@
+#ifndef lparse_h
+#define lparse_h
+
+#include "mpc.h"
+
+/* Grammar of the language, whole programs parse as Lispy */
+extern mpc_parser_t* Float;
+extern mpc_parser_t* Number;
+extern mpc_parser_t* Symbol;
+extern mpc_parser_t* String;
+extern mpc_parser_t* Comment;
+extern mpc_parser_t* Sexpr;
+extern mpc_parser_t* Qexpr;
+extern mpc_parser_t* Expr;
+extern mpc_parser_t* Lispy;
+
+void lparse_init(void);
+void lparse_cleanup(void);
+
+#endif
@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lsym.h"
+
+/* Symbol table: open addressing over the interned names */
+
+static LSYM** table;
+static size_t cap;
+static size_t count;
+
+char* lsym_amp;
+
+static size_t lsym_hash(char* s) {
+    /* FNV-1a */
+    uint64_t h = 14695981039346656037ull;
+    for (; *s; s++) { h = (h ^ (unsigned char)*s) * 1099511628211ull; }
+    return h;
+}
+
+static void lsym_grow(void) {
+    size_t ncap = cap ? 2 * cap : 256;
+    LSYM** n = calloc(ncap, sizeof(LSYM*));
+    for (size_t i = 0; i < cap; i++) {
+        if (!table[i]) { continue; }
+        size_t j = lsym_hash(table[i]->name) & (ncap - 1);
+        while (n[j]) { j = (j + 1) & (ncap - 1); }
+        n[j] = table[i];
+    }
+    free(table);
+    table = n;
+    cap = ncap;
+}
+
+void lsym_init(void) {
+    lsym_amp = lsym_intern("&");
+}
+
+/**
+ * Get the interned copy of a name, adding it on first sight. Names are
+ * never freed before lsym_cleanup, so they don't belong to any region.
+ */
+char* lsym_intern(char* s) {
+    if (2 * (count + 1) > cap) { lsym_grow(); }
+
+    size_t i = lsym_hash(s) & (cap - 1);
+    while (table[i]) {
+        if (strcmp(table[i]->name, s) == 0) { return table[i]->name; }
+        i = (i + 1) & (cap - 1);
+    }
+
+    table[i] = malloc(sizeof(LSYM) + strlen(s) + 1);
+    table[i]->binds = 0;
+    table[i]->version = 0;
+    strcpy(table[i]->name, s);
+    count++;
+    return table[i]->name;
+}
+
+void lsym_cleanup(void) {
+    for (size_t i = 0; i < cap; i++) { free(table[i]); }
+    free(table);
+    table = NULL;
+    cap = count = 0;
+    lsym_amp = NULL;
+}
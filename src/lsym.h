@@ -0,0 +1,42 @@
+#ifndef lsym_h
+#define lsym_h
+
+#include <stddef.h>
+
+/*
+ * Interned symbol names. Every distinct name is stored once, so two
+ * symbols are the same symbol exactly when their names are the same
+ * pointer.
+ */
+
+/* What's known about a name, kept just in front of it */
+typedef struct {
+    int binds;          /* bindings of this name across all envs */
+    unsigned version;   /* bumped when one is added, removed or rebound */
+    char name[];
+} LSYM;
+
+void  lsym_init(void);
+void  lsym_cleanup(void);
+char* lsym_intern(char* s);
+
+static inline LSYM* lsym_of(char* sym) {
+    return (LSYM*)(sym - offsetof(LSYM, name));
+}
+
+static inline void lsym_bind(char* sym) {
+    LSYM* s = lsym_of(sym);
+    s->binds++;
+    s->version++;
+}
+
+static inline void lsym_unbind(char* sym) {
+    LSYM* s = lsym_of(sym);
+    s->binds--;
+    s->version++;
+}
+
+/* The '&' of variadic formals */
+extern char* lsym_amp;
+
+#endif
@@ -1,4 +1,15 @@
+#include <float.h>
+#include <math.h>
+#include <inttypes.h>
+
 #include "lval.h"
+#include "lgc.h"
+#include "leval.h"
+#include "lvm.h"
+#include "laot.h"
+#include "lopt.h"
+#include "lbig.h"
+#include "lvec.h"
 
 /* Lisp values */
 
@@ -6,6 +17,9 @@ char* ltype_name(int t) {
     switch(t) {
     case LVAL_FUN: return "function";
     case LVAL_NUM: return "number";
+    case LVAL_BIG: return "number";
+    case LVAL_FLT: return "float";
+    case LVAL_VEC: return "vec";
     case LVAL_ERR: return "error";
     case LVAL_SYM: return "symbol";
     case LVAL_STR: return "string";
@@ -15,62 +29,126 @@ char* ltype_name(int t) {
     }
 }
 
+/* Payload extent of a given member, measured from the start of LVAL */
+#define LVAL_EXTENT(member) \
+    (offsetof(LVAL, member) + sizeof(((LVAL*)0)->member))
+
+/* Bytes needed to hold a value of a given type */
+size_t lval_size(int t) {
+    switch(t) {
+    case LVAL_NUM: return LVAL_EXTENT(num);
+    case LVAL_BIG: return LVAL_EXTENT(big);
+    case LVAL_FLT: return LVAL_EXTENT(flt);
+    case LVAL_VEC: return LVAL_EXTENT(vec);
+    case LVAL_ERR: return LVAL_EXTENT(err);
+    case LVAL_SYM: return LVAL_EXTENT(version);
+    case LVAL_STR: return LVAL_EXTENT(str);
+    case LVAL_SEXPR:
+    case LVAL_QEXPR: return LVAL_EXTENT(base);
+    default: return sizeof(LVAL);
+    }
+}
+
+/* Allocate a value, trimmed to the payload of its type */
+static LVAL* lval_alloc(int type) {
+    LVAL* v = lalloc_kind(LALLOC_VAL, lval_size(type));
+    v->type = type;
+    v->refs = 1;
+    return v;
+}
+
 /* LVAL constructors */
 
 LVAL* lval_num(long x) {
-    LVAL* v = malloc(sizeof(LVAL));
-    v->type = LVAL_NUM;
+    if (x >= LVAL_FIXNUM_MIN && x <= LVAL_FIXNUM_MAX) {
+        return lval_fixnum(x);
+    }
+
+    LVAL* v = lval_alloc(LVAL_NUM);
     v->num = x;
     return v;
 }
 
+/* A number too big for a long, taking over its digits */
+LVAL* lval_big(LBIG* b) {
+    LVAL* v = lval_alloc(LVAL_BIG);
+    v->big = b;
+    return v;
+}
+
+LVAL* lval_flt(double x) {
+    LVAL* v = lval_alloc(LVAL_FLT);
+    v->flt = x;
+    return v;
+}
+
+/* A packed vector, taking it over */
+LVAL* lval_vec(LVEC* vec) {
+    LVAL* v = lval_alloc(LVAL_VEC);
+    v->vec = vec;
+    return v;
+}
+
+/* Any number as a double, rounding integers too wide for one */
+double lreal(LVAL* v) {
+    switch (ltype(v)) {
+    case LVAL_FLT: return v->flt;
+    case LVAL_BIG: return lbig_double(v->big);
+    default: return lnum(v);
+    }
+}
+
 LVAL* lval_sym(char* s) {
-    LVAL* v = malloc(sizeof(LVAL));
-    v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
+    LVAL* v = lval_alloc(LVAL_SYM);
+    v->sym = lsym_intern(s);
+    v->depth = LVAL_UNRESOLVED;
+    v->slot = 0;
+    v->global = NULL;
+    v->version = 0;
     return v;
 }
 
 LVAL* lval_str(char* s) {
-    LVAL* v = malloc(sizeof(LVAL));
-    v->type = LVAL_STR;
-    v->str = malloc(strlen(s) + 1);
+    LVAL* v = lval_alloc(LVAL_STR);
+    v->str = lalloc(strlen(s) + 1);
     strcpy(v->str, s);
     return v;
 }
 
 LVAL* lval_sexpr(void) {
-    LVAL* v = malloc(sizeof(LVAL));
-    v->type = LVAL_SEXPR;
+    LVAL* v = lval_alloc(LVAL_SEXPR);
     v->count = 0;
+    v->cap = 0;
     v->cell = NULL;
+    v->off = 0;
     return v;
 }
 
 LVAL* lval_qexpr(void) {
-    LVAL* v = malloc(sizeof(LVAL));
-    v->type = LVAL_QEXPR;
+    LVAL* v = lval_alloc(LVAL_QEXPR);
     v->count = 0;
+    v->cap = 0;
     v->cell = NULL;
+    v->off = 0;
     return v;
 }
 
 LVAL* lval_fun(LBUILTIN func, char *name) {
-    LVAL* v = malloc(sizeof(LVAL));
-    v->type = LVAL_FUN;
+    LVAL* v = lval_alloc(LVAL_FUN);
     v->builtin = func;
-    v->sym = malloc(strlen(name) + 1);
-    strcpy(v->sym, name);
+    v->name = malloc(strlen(name) + 1);
+    strcpy(v->name, name);
     return v;
 }
 
 LVAL* lval_lambda(LVAL* formals, LVAL* body) {
-    LVAL* v = malloc(sizeof(LVAL));
-    v->type = LVAL_FUN;
+    LVAL* v = lval_alloc(LVAL_FUN);
     v->builtin = NULL;
     v->formals = formals;
     v->body = body;
+    v->code = NULL;
+    v->native = NULL;
+    v->opt = NULL;
 
     /* Build new environment */
     v->env = lenv_new();
@@ -79,8 +157,7 @@ LVAL* lval_lambda(LVAL* formals, LVAL* body) {
 }
 
 LVAL* lval_err(char* fmt, ...) {
-    LVAL* v = malloc(sizeof(LVAL));
-    v->type = LVAL_ERR;
+    LVAL* v = lval_alloc(LVAL_ERR);
     v->err = malloc(512);
 
     va_list va;
@@ -97,28 +174,49 @@ LVAL* lval_err(char* fmt, ...) {
 
 /* LVAL utils */
 
-int lval_eq(LVAL* x, LVAL* y) {
-    if (x->type != y->type) { return 0; }
+/* Whether an integer, big or not, has exactly the value of a float */
+static int lval_eq_flt(LVAL* n, double f) {
+    if (!isfinite(f) || f != floor(f)) { return 0; }
+    if (ltype(n) == LVAL_NUM && fabs(f) < 0x1p62) { return lnum(n) == (long)f; }
 
-    switch (x->type) {
-    case LVAL_NUM: return (x->num == y->num);
+    LVAL* m = lbig_of_double(f);
+    int eq = lbig_cmp(n, m) == 0;
+    lval_del(m);
+    return eq;
+}
+
+/* Equality, with numbers of different kinds compared by value or not */
+static int lval_eq_as(LVAL* x, LVAL* y, int exact) {
+    if (ltype(x) != ltype(y)) {
+        if (exact || !lval_is_number(x) || !lval_is_number(y)) { return 0; }
+        if (ltype(x) == LVAL_FLT) { return lval_eq_flt(y, x->flt); }
+        if (ltype(y) == LVAL_FLT) { return lval_eq_flt(x, y->flt); }
+        return 0;
+    }
+
+    switch (ltype(x)) {
+    case LVAL_NUM: return (lnum(x) == lnum(y));
+    case LVAL_BIG: return lbig_eq(x->big, y->big);
+    case LVAL_FLT: return x->flt == y->flt;
+    case LVAL_VEC: return lvec_eq(x->vec, y->vec);
     case LVAL_ERR: return (strcmp(x->err, y->err) == 0);
-    case LVAL_SYM: return (strcmp(x->sym, y->sym) == 0);
+    case LVAL_SYM: return x->sym == y->sym;
     case LVAL_STR: return (strcmp(x->str, y->str) == 0);
 
     case LVAL_FUN:
         if (x->builtin || y->builtin) {
             return x->builtin == y->builtin;
         } else {
-            return lval_eq(x->formals, y->formals)
-                && lval_eq(x->body, y->body);
+            return lval_eq_as(x->formals, y->formals, exact)
+                && lval_eq_as(x->body, y->body, exact);
         }
 
     case LVAL_QEXPR:
     case LVAL_SEXPR:
         if (x->count != y->count) { return 0; }
+        if (x->cell == y->cell) { return 1; }
         for (int i = 0; i < x->count; i++) {
-            if (!lval_eq(x->cell[i], y->cell[i])) { return 0; }
+            if (!lval_eq_as(x->cell[i], y->cell[i], exact)) { return 0; }
         }
         return 1;
         break;
@@ -126,56 +224,128 @@ int lval_eq(LVAL* x, LVAL* y) {
     return 0;
 }
 
+/* A float equals an integer, big or not, of exactly the same value */
+int lval_eq(LVAL* x, LVAL* y) {
+    return lval_eq_as(x, y, 0);
+}
+
+/* Whether x and y are written alike: no number equals one of another kind */
+int lval_same(LVAL* x, LVAL* y) {
+    return lval_eq_as(x, y, 1);
+}
+
+/* Give a slice cells of its own, in the same region as it */
+static void lval_unslice(LVAL* v) {
+    LVAL** cell = lrealloc(v, NULL, 0, sizeof(LVAL*) * v->count);
+    for (int i = 0; i < v->count; i++) {
+        cell[i] = lval_ref(v->cell[i]);
+    }
+    lval_del(v->base);
+    v->cap = v->count;
+    v->cell = cell;
+    v->off = 0;
+}
+
+/*
+ * Make room in an owned list for count cells. Space popped off the
+ * front is reused before growing, and growth at least doubles, so that
+ * adding cells one at a time costs amortised constant time.
+ */
+void lval_reserve(LVAL* v, int count) {
+    if (lval_is_slice(v)) { lval_unslice(v); }
+    if (count <= v->cap - v->off) { return; }
+
+    LVAL** block = v->cell - v->off;
+    if (v->off) {
+        memmove(block, v->cell, sizeof(LVAL*) * v->count);
+        v->cell = block;
+        v->off = 0;
+        if (count <= v->cap) { return; }
+    }
+
+    int cap = v->cap < 2 ? 4 : 2 * v->cap;
+    if (cap < count) { cap = count; }
+    v->cell = lrealloc(v, block, sizeof(LVAL*) * v->cap, sizeof(LVAL*) * cap);
+    v->cap = cap;
+}
+
 LVAL* lval_add(LVAL* v, LVAL* x) {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(LVAL*) * v->count);
-    v->cell[v->count-1] = x;
+    /* Write barrier: values outside the nursery never point into it */
+    if (!lval_is_fixnum(x) && lalloc_region_active() &&
+        !lalloc_in_region(v) && lalloc_in_region(x)) {
+        LVAL* young = x;
+        x = lgc_tenure(young);
+        lval_del(young);
+    }
+
+    lval_reserve(v, v->count + 1);
+    v->cell[v->count++] = x;
     return v;
 }
 
+/*
+ * Copy the top level of a value. Children are shared rather than
+ * copied, which is safe because shared values are never mutated.
+ */
 LVAL* lval_copy(LVAL* v) {
-    LVAL* x = malloc(sizeof(LVAL));
-    x->type = v->type;
+    /* Immediates are their own copy */
+    if (lval_is_fixnum(v)) { return v; }
+
+    LVAL* x = lval_alloc(v->type);
 
     switch (v->type) {
 
     /* Copy numbers directly */
     case LVAL_NUM: x->num = v->num; break;
+    case LVAL_BIG: x->big = lbig_copy(v->big); break;
+    case LVAL_FLT: x->flt = v->flt; break;
+    case LVAL_VEC: x->vec = lvec_copy(v->vec); break;
 
-    /* Copy strings using malloc and strcpy */
+    /* Copy error messages with malloc, as lval_err makes them */
     case LVAL_ERR:
         x->err = malloc(strlen(v->err) + 1);
         strcpy(x->err, v->err); break;
 
     case LVAL_SYM:
-        x->sym = malloc(strlen(v->sym) + 1);
-        strcpy(x->sym, v->sym); break;
+        x->sym = v->sym;
+        x->depth = v->depth;
+        x->slot = v->slot;
+        x->global = v->global;
+        x->version = v->version; break;
 
+    /* Copy strings using lalloc and strcpy */
     case LVAL_STR:
-        x->str = malloc(strlen(v->str) + 1);
+        x->str = lalloc(strlen(v->str) + 1);
         strcpy(x->str, v->str); break;
 
     case LVAL_FUN:
         x->builtin = v->builtin;
 
         if (v->builtin) {
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->sym, v->sym);
+            x->name = malloc(strlen(v->name) + 1);
+            strcpy(x->name, v->name);
         }
         else {
             x->env = lenv_copy(v->env);
-            x->formals = lval_copy(v->formals);
-            x->body = lval_copy(v->body);
+            x->formals = lval_ref(v->formals);
+            x->body = lval_ref(v->body);
+            x->code = v->code;
+            if (x->code) { x->code->refs++; }
+            x->native = v->native;
+            x->opt = v->opt;
+            if (x->opt) { x->opt->refs++; }
         }
         break;
 
-    /* Copy lists by copying each sub-expression */
+    /* Copy lists by sharing each sub-expression, but not the cells */
     case LVAL_SEXPR:
     case LVAL_QEXPR:
         x->count = v->count;
-        x->cell = malloc(sizeof(LVAL*) * x->count);
+        x->cap = v->count;
+        x->cell = lalloc(sizeof(LVAL*) * x->count);
+        x->off = 0;
         for (int i = 0; i < x->count; i++) {
-            x->cell[i] = lval_copy(v->cell[i]);
+            x->cell[i] = lval_ref(v->cell[i]);
         }
         break;
     }
@@ -183,69 +353,159 @@ LVAL* lval_copy(LVAL* v) {
     return x;
 }
 
+/*
+ * Turn a reference into one that may be mutated in place. That's only
+ * the case when nobody else holds the value, it has cells of its own if
+ * a list, and it lives where new allocations go; otherwise the
+ * reference is swapped for a copy.
+ */
+LVAL* lval_own(LVAL* v) {
+    if (lval_is_fixnum(v)) { return v; }
+    if (v->refs == 1 && !lval_is_slice(v) &&
+        lalloc_in_region(v) == lalloc_region_active()) {
+        return v;
+    }
+
+    LVAL* x = lval_copy(v);
+    lval_del(v);
+    return x;
+}
+
+/* Drop a reference, freeing the value with the last one */
 void lval_del(LVAL* v) {
+    if (lval_is_fixnum(v)) { return; }
+    if (--v->refs > 0) { return; }
 
     switch (v->type) {
     case LVAL_NUM: break;
+    case LVAL_BIG: lbig_free(v->big); break;
+    case LVAL_FLT: break;
+    case LVAL_VEC: lvec_free(v->vec); break;
 
     case LVAL_ERR: free(v->err); break;
-    case LVAL_SYM: free(v->sym); break;
-    case LVAL_STR: free(v->str); break;
+    case LVAL_SYM: break;
+    case LVAL_STR: lfree(v->str, strlen(v->str) + 1); break;
 
     case LVAL_FUN:
-        if (!v->builtin) {
+        if (v->builtin) {
+            free(v->name);
+        } else {
             lenv_del(v->env);
             lval_del(v->formals);
             lval_del(v->body);
+            lvm_release(v->code);
+            lopt_release(v->opt);
         }
         break;
 
     /* If Sexpr or Qexpr, delete all the nested elements */
     case LVAL_SEXPR:
     case LVAL_QEXPR:
+        /* A slice's cells belong to its base */
+        if (lval_is_slice(v)) {
+            lval_del(v->base);
+            break;
+        }
         for (int i = 0; i < v->count; i++) {
             lval_del(v->cell[i]);
         }
         /* Also free the memory allocated to contain the pointers */
-        free(v->cell);
+        lfree(v->cell - v->off, sizeof(LVAL*) * v->cap);
         break;
     }
 
     /* Free the memory allocated for the "LVAL" struct itself */
-    free(v);
+    lfree_kind(LALLOC_VAL, v, lval_size(v->type));
 }
 
-/* Extract an i-th element from an sexpr */
+/* Extract an i-th element from an owned sexpr */
 LVAL* lval_pop(LVAL* v, int i) {
+    /* The front of a slice comes off by narrowing it */
+    if (lval_is_slice(v) && i == 0) {
+        v->cell++;
+        v->count--;
+        return lval_ref(v->cell[-1]);
+    }
+    if (lval_is_slice(v)) { lval_unslice(v); }
+
     LVAL* x = v->cell[i];
 
-    /* Shift memory after the item at "i" over the top */
-    memmove(&v->cell[i], &v->cell[i+1],
-            sizeof(LVAL*) * (v->count-i-1));
+    /* The front comes off by moving past it, the rest by shifting over it */
+    if (i == 0) {
+        v->cell++;
+        v->off++;
+    } else {
+        memmove(&v->cell[i], &v->cell[i+1],
+                sizeof(LVAL*) * (v->count-i-1));
+    }
 
     /* Decrease the count of items in the list */
     v->count--;
-
-    /* Reallocate the memory used */
-    v->cell = realloc(v->cell, sizeof(LVAL*) * v->count);
     return x;
 }
 
 /* Extract an i-th element from an sexpr and delete the rest */
 LVAL* lval_take(LVAL* v, int i) {
+    /* No need to pop from a shared list, just share the element */
+    if (v->refs > 1 || lval_is_slice(v)) {
+        LVAL* x = lval_ref(v->cell[i]);
+        lval_del(v);
+        return x;
+    }
+
     LVAL* x = lval_pop(v, i);
     lval_del(v);
     return x;
 }
 
+/*
+ * Append y's elements to x. Once owned, x is where new allocations go,
+ * so it may point at anything and the write barrier isn't needed.
+ */
 LVAL* lval_join(LVAL* x, LVAL* y) {
-    while (y->count) {
-        x = lval_add(x, lval_pop(y, 0));
+    x = lval_own(x);
+    lval_reserve(x, x->count + y->count);
+
+    int n = y->count;
+    if (y->refs > 1 || lval_is_slice(y)) {
+        for (int i = 0; i < n; i++) {
+            x->cell[x->count + i] = lval_ref(y->cell[i]);
+        }
+    } else if (n) {
+        /* Move the elements over, leaving y none to let go of */
+        memcpy(&x->cell[x->count], y->cell, sizeof(LVAL*) * n);
+        y->count = 0;
     }
+    x->count += n;
     lval_del(y);
     return x;
 }
 
+/*
+ * The count elements of list v from start, as a slice sharing v's
+ * cells rather than copying them. Takes over the reference to v.
+ */
+LVAL* lval_slice(LVAL* v, int start, int count) {
+    /* Nobody else sees this slice, so narrow it where it is */
+    if (lval_is_slice(v) && v->refs == 1) {
+        v->cell += start;
+        v->count = count;
+        return v;
+    }
+
+    LVAL* x = lval_alloc(v->type);
+    x->count = count;
+    x->cap = LVAL_SLICE;
+    x->cell = v->cell + start;
+    if (lval_is_slice(v)) {
+        x->base = lval_ref(v->base);
+        lval_del(v);
+    } else {
+        x->base = v;
+    }
+    return x;
+}
+
 void lval_print_str(LVAL* v) {
     char* escaped = malloc(strlen(v->str) + 1);
     strcpy(escaped, v->str);
@@ -267,9 +527,47 @@ void lval_print_expr(LVAL* v, char open, char close) {
     putchar(close);
 }
 
+/*
+ * Shortest digits that read back as the same double. When 15 or fewer
+ * do, %.15g finds them, as it drops trailing zeros; only subnormals,
+ * having less precision, need fewer tried. Failing that, 16 or 17.
+ * Always with a point or exponent, so it reads back as a float.
+ */
+void lval_print_flt(double x) {
+    if (isnan(x)) { fputs("nan", stdout); return; }
+
+    char buf[32];
+    int prec = x != 0 && fabs(x) < DBL_MIN ? 1 : 15;
+    for (; prec <= 17; prec++) {
+        snprintf(buf, sizeof(buf), "%.*g", prec, x);
+        if (strtod(buf, NULL) == x) { break; }
+    }
+    fputs(buf, stdout);
+    if (isfinite(x) && !strpbrk(buf, ".e")) { fputs(".0", stdout); }
+}
+
+/* As the call that makes it */
+void lval_print_vec(LVEC* v) {
+    printf("(vec {");
+    for (int i = 0; i < v->count; i++) {
+        if (i) { putchar(' '); }
+        if (v->type == LVAL_FLT) { lval_print_flt(v->f[i]); }
+        else { printf("%" PRId64, v->i[i]); }
+    }
+    printf("})");
+}
+
 void lval_print(LVAL* v) {
-    switch (v->type) {
-    case LVAL_NUM:   printf("%li", v->num); break;
+    switch (ltype(v)) {
+    case LVAL_NUM:   printf("%li", lnum(v)); break;
+    case LVAL_BIG: {
+        char* s = lbig_str(v->big);
+        fputs(s, stdout);
+        free(s);
+        break;
+    }
+    case LVAL_FLT:   lval_print_flt(v->flt); break;
+    case LVAL_VEC:   lval_print_vec(v->vec); break;
     case LVAL_ERR:   printf("Error: %s", v->err); break;
     case LVAL_SYM:   printf("%s", v->sym); break;
     case LVAL_STR:   lval_print_str(v); break;
@@ -277,7 +575,7 @@ void lval_print(LVAL* v) {
     case LVAL_QEXPR: lval_print_expr(v, '{', '}'); break;
     case LVAL_FUN:
         if (v->builtin) {
-            printf("<%s>", v->sym);
+            printf("<%s>", v->name);
         } else {
             printf("(-> "); lval_print(v->formals);
             putchar(' '); lval_print(v->body); putchar(')');
@@ -296,10 +594,14 @@ LVAL* lval_read_num(mpc_ast_t* t) {
         return lval_num(x);
     }
     else {
-        return lval_err("invalid number");
+        return lbig_parse(t->contents);
     }
 }
 
+LVAL* lval_read_flt(mpc_ast_t* t) {
+    return lval_flt(strtod(t->contents, NULL));
+}
+
 LVAL* lval_read_str(mpc_ast_t* t) {
     /* Cut off the final quote character */
     t->contents[strlen(t->contents) - 1] = '\0';
@@ -321,6 +623,7 @@ LVAL* lval_read_str(mpc_ast_t* t) {
 
 LVAL* lval_read(mpc_ast_t* t) {
     /* If Symbol or Number return conversion to that type */
+    if (strstr(t->tag, "float"))  { return lval_read_flt(t); }
     if (strstr(t->tag, "number")) { return lval_read_num(t); }
     if (strstr(t->tag, "string")) { return lval_read_str(t); }
     if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
@@ -332,6 +635,7 @@ LVAL* lval_read(mpc_ast_t* t) {
     if (strstr(t->tag, "qexpr"))  { x = lval_qexpr(); }
 
     /* Fill this list with any valid expression contained within */
+    lval_reserve(x, t->children_num);
     for (int i = 0; i < t->children_num; i++) {
         if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
         if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
@@ -345,10 +649,15 @@ LVAL* lval_read(mpc_ast_t* t) {
     return x;
 }
 
-LVAL* lval_call(LENV* e, LVAL* f, LVAL* a) {
+/**
+ * Bind arguments to a lambda's formals. Returns the function, ready to
+ * run if no formals are left over, or an error.
+ */
+LVAL* lval_bind(LENV* e, LVAL* f, LVAL* a) {
 
-    /* If Builtin then simply apply that */
-    if (f->builtin) { return f->builtin(e, a); }
+    /* Binding arguments mutates the function and its formals */
+    f = lval_own(f);
+    f->formals = lval_own(f->formals);
 
     /* Record argument counts */
     int given = a->count;
@@ -360,6 +669,7 @@ LVAL* lval_call(LENV* e, LVAL* f, LVAL* a) {
         /* If we've ran out of formal arguments to bind */
         if (f->formals->count == 0) {
             lval_del(a);
+            lval_del(f);
             return lval_err("Function passed too many arguments. "
                             "Got %i, expected %i.", given, total);
         }
@@ -368,11 +678,13 @@ LVAL* lval_call(LENV* e, LVAL* f, LVAL* a) {
         LVAL* sym = lval_pop(f->formals, 0);
 
         /* Special case to deal with '&' */
-        if (strcmp(sym->sym, "&") == 0) {
+        if (sym->sym == lsym_amp) {
 
             /* Ensure '&' is followed by another symbol */
             if (f->formals->count != 1) {
                 lval_del(a);
+                lval_del(f);
+                lval_del(sym);
                 return lval_err("Function format invalid. "
                                 "Symbol '&' not followed by single symbol.");
             }
@@ -397,10 +709,12 @@ LVAL* lval_call(LENV* e, LVAL* f, LVAL* a) {
 
     /* If '&' remains in formal list, bind to empty list */
     if (f->formals->count > 0 &&
-        strcmp(f->formals->cell[0]->sym, "&") == 0) {
+        f->formals->cell[0]->sym == lsym_amp) {
 
         /* Check to ensure that & is not passed invalidly. */
         if (f->formals->count != 2) {
+            lval_del(a);
+            lval_del(f);
             return lval_err("Function format invalid. "
                             "Symbol '&' not followed by single symbol.");
         }
@@ -420,60 +734,182 @@ LVAL* lval_call(LENV* e, LVAL* f, LVAL* a) {
     /* Argument list is now bound so can be cleaned up */
     lval_del(a);
 
-    /* If all formals have been bound, evaluate */
-    if (f->formals->count == 0) {
-
-        /* Set environment parent to evaluation environment */
-        f->env->parent = e;
-
-        /* Evaluate and return */
-        return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-    }
-    /* Otherwise return partially evaluated function */
-    else {
-        return lval_copy(f);
-    }
+    return f;
 }
 
-LVAL* lval_eval_sexpr(LENV* e, LVAL* v) {
-    /* Eval children */
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
-    }
+/* A lambda's body, as an expression to evaluate */
+LVAL* lval_body(LVAL* f) {
+    LVAL* x = lval_copy(lopt_body(f));
+    x->type = LVAL_SEXPR;
+    return x;
+}
 
-    /* Error checking */
-    for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
-    }
+LVAL* lval_call(LENV* e, LVAL* f, LVAL* a) {
 
-    /* Empty and single expressions */
-    if (v->count == 0) { return v; }
-    if (v->count == 1) { return lval_take(v, 0); }
-
-    /* Ensure first element is a function after evaluation */
-    LVAL* f = lval_pop(v, 0);
-    if (f->type != LVAL_FUN) {
-        LVAL* err = lval_err(
-            "S-Expression starts with incorrect type. "
-            "Got %s, expected %s.",
-            ltype_name(f->type), ltype_name(LVAL_FUN));
+    /* If Builtin then simply apply that */
+    if (f->builtin) {
+        LVAL* result = f->builtin(e, a);
         lval_del(f);
-        lval_del(v);
-        return err;
+        return result;
     }
 
-    /* Call function and return the result */
-    LVAL* result = lval_call(e, f, v);
+    /* Return errors and partially applied functions as they are */
+    f = lval_bind(e, f, a);
+    if (ltype(f) == LVAL_ERR || f->formals->count) { return f; }
+
+    /* Set environment parent to evaluation environment */
+    f->env->parent = e;
+
+    /* Evaluate and return */
+    LVAL* result = lval_eval(f->env, lval_body(f));
     lval_del(f);
     return result;
 }
 
 LVAL* lval_eval(LENV* e, LVAL* v) {
-    if (v->type == LVAL_SYM) {
-        LVAL* x = lenv_get(e, v);
+    if (leval_engine == LEVAL_STACK) { return leval_stack(e, v); }
+    return lval_eval_tree(e, v);
+}
+
+static long tree_depth;
+
+/**
+ * Evaluate a value by walking it, recursing on the C stack for
+ * arguments. Tail positions (a lambda body, the chosen branch
+ * of if, the argument of eval and the only element of an expression)
+ * are evaluated by going round the loop rather than recursing, so
+ * iteration written as tail recursion runs in constant C stack.
+ *
+ * Lambdas whose bodies are running in tail position are held until
+ * the end. Scoping is dynamic, so a tail callee still sees its caller's
+ * frame, except when it binds every name there anyway: then the
+ * caller can be dropped and the callee put in its place.
+ */
+LVAL* lval_eval_tree(LENV* e, LVAL* v) {
+    if (leval_max_depth && tree_depth >= leval_max_depth) {
         lval_del(v);
-        return x;
+        return leval_too_deep();
     }
-    if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
-    return v;
+    tree_depth++;
+
+    LVAL* held_local[8];
+    LVAL** held = held_local;
+    int nheld = 0;
+    int cap = 8;
+
+    LVAL* result;
+    while (1) {
+        if (ltype(v) == LVAL_SYM) {
+            result = lenv_get(e, v);
+            lval_del(v);
+            break;
+        }
+        if (ltype(v) != LVAL_SEXPR) {
+            result = v;
+            break;
+        }
+
+        v = lval_own(v);
+
+        /* Single expressions */
+        if (v->count == 1) {
+            v = lval_take(v, 0);
+            continue;
+        }
+
+        /* Eval children */
+        for (int i = 0; i < v->count; i++) {
+            v->cell[i] = lval_eval_tree(e, v->cell[i]);
+        }
+
+        /* Error checking */
+        int err = -1;
+        for (int i = 0; i < v->count && err < 0; i++) {
+            if (ltype(v->cell[i]) == LVAL_ERR) { err = i; }
+        }
+        if (err >= 0) {
+            result = lval_take(v, err);
+            break;
+        }
+
+        /* Empty expressions */
+        if (v->count == 0) {
+            result = v;
+            break;
+        }
+
+        /* Ensure first element is a function after evaluation */
+        LVAL* f = lval_pop(v, 0);
+        if (ltype(f) != LVAL_FUN) {
+            result = lval_err(
+                "S-Expression starts with incorrect type. "
+                "Got %s, expected %s.",
+                ltype_name(ltype(f)), ltype_name(LVAL_FUN));
+            lval_del(f);
+            lval_del(v);
+            break;
+        }
+
+        /* if and eval go on to evaluate an expression in this env */
+        if (f->builtin == builtin_if || f->builtin == builtin_eval) {
+            v = f->builtin == builtin_if ? builtin_if_expr(e, v)
+                                         : builtin_eval_expr(e, v);
+            lval_del(f);
+            continue;
+        }
+
+        if (f->builtin) {
+            result = f->builtin(e, v);
+            lval_del(f);
+            break;
+        }
+
+        if (f->native) {
+            LVAL* x = laot_call(f, v);
+            if (x) {
+                result = x;
+                break;
+            }
+        }
+
+        if (leval_engine == LEVAL_VM || leval_engine == LEVAL_CLOSURE) {
+            result = lvm_apply(e, f, v);
+            break;
+        }
+
+        f = lval_bind(e, f, v);
+        if (ltype(f) == LVAL_ERR || f->formals->count) {
+            result = f;
+            break;
+        }
+
+        /* Tail call: drop the finished frames the callee hides anyway */
+        f->env->parent = e;
+        while (nheld && e == held[nheld - 1]->env &&
+               lenv_shadows(f->env, e)) {
+            e = e->parent;
+            f->env->parent = e;
+            lval_del(held[--nheld]);
+        }
+
+        if (nheld == cap) {
+            cap *= 2;
+            if (held == held_local) {
+                held = malloc(sizeof(LVAL*) * cap);
+                memcpy(held, held_local, sizeof(held_local));
+            } else {
+                held = realloc(held, sizeof(LVAL*) * cap);
+            }
+        }
+        held[nheld++] = f;
+
+        e = f->env;
+        v = lval_body(f);
+    }
+
+    while (nheld) { lval_del(held[--nheld]); }
+    if (held != held_local) { free(held); }
+
+    tree_depth--;
+    return result;
 }
@@ -1,7 +1,13 @@
 #ifndef lval_h
 #define lval_h
 
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+
 #include "mpc.h"
+#include "lalloc.h"
+#include "lsym.h"
 #include "lenv.h"
 
 enum {
@@ -11,35 +17,132 @@ enum {
     LVAL_STR,
     LVAL_SEXPR,
     LVAL_QEXPR,
-    LVAL_FUN
+    LVAL_FUN,
+    LVAL_BIG,
+    LVAL_FLT,
+    LVAL_VEC
 };
 
 struct LENV;
+struct LBIG;
+struct LVEC;
+struct LCODE;
+struct LNATIVE;
+struct LOPT;
 struct LVAL;
 typedef struct LVAL LVAL;
 
+/* Capacity of a list that shares another's cells, see lval_slice */
+#define LVAL_SLICE (-1)
+
+/* Symbol depths that aren't a frame count */
+#define LVAL_UNRESOLVED (-1)
+#define LVAL_GLOBAL     (-2)
+
 typedef LVAL*(*LBUILTIN)(struct LENV*, LVAL*);
 
 struct LVAL {
     int type;
-
-    /* Basic */
-    long num;
-    char* err;
-    char* sym;
-    char* str;
-
-    /* Function */
-    LBUILTIN builtin;
-    struct LENV* env;
-    LVAL* formals;
-    LVAL* body;
-
-    /* Expression */
-    int count;
-    LVAL** cell;
+    int refs;
+
+    /* Payload, discriminated by type */
+    union {
+        /* Basic */
+        long num;
+        struct LBIG* big;
+        double flt;
+        struct LVEC* vec;
+        char* err;
+        char* str;
+
+        /*
+         * Symbol, interned so compare by pointer. depth/slot say which
+         * frame up from the evaluating env is expected to bind it, and
+         * where. They're only a hint, see lenv_get.
+         */
+        struct {
+            char* sym;
+            int depth;
+            int slot;
+
+            /* Inline cache for depth LVAL_GLOBAL */
+            struct LENV* global;
+            unsigned version;
+        };
+
+        /* Function (builtin is NULL for lambdas) */
+        struct {
+            LBUILTIN builtin;
+            union {
+                char* name;
+                struct {
+                    struct LENV* env;
+                    LVAL* formals;
+                    LVAL* body;
+                    struct LCODE* code;     /* compiled body, if any */
+                    struct LNATIVE* native; /* compiled ahead of time, if any */
+                    struct LOPT* opt;       /* body with constants folded, if any */
+                };
+            };
+        };
+
+        /*
+         * Expression. Its cells start off cells into an allocation of
+         * cap, so both ends have room to shrink and the back to grow.
+         * A slice (cap LVAL_SLICE) borrows its cells from the list in
+         * base instead, holding a reference to that rather than to each
+         * of them.
+         */
+        struct {
+            int count;
+            int cap;
+            LVAL** cell;
+            union {
+                int off;
+                LVAL* base;
+            };
+        };
+    };
 };
 
+/*
+ * Small integers are stored in the LVAL pointer itself, tagged by the
+ * low bit (allocations are always at least 2-aligned). Only numbers
+ * outside the fixnum range get a heap-allocated LVAL_NUM.
+ */
+#define LVAL_FIXNUM_MIN (LONG_MIN >> 1)
+#define LVAL_FIXNUM_MAX (LONG_MAX >> 1)
+
+static inline int lval_is_fixnum(LVAL* v) {
+    return (uintptr_t)v & 1;
+}
+
+static inline LVAL* lval_fixnum(long x) {
+    return (LVAL*)(((uintptr_t)x << 1) | 1);
+}
+
+/* Type of any value, immediate or boxed */
+static inline int ltype(LVAL* v) {
+    return lval_is_fixnum(v) ? LVAL_NUM : v->type;
+}
+
+/* Numeric payload of any LVAL_NUM, immediate or boxed */
+static inline long lnum(LVAL* v) {
+    return lval_is_fixnum(v) ? (long)((intptr_t)v >> 1) : v->num;
+}
+
+/* Take another reference to a value */
+static inline LVAL* lval_ref(LVAL* v) {
+    if (!lval_is_fixnum(v)) { v->refs++; }
+    return v;
+}
+
+/* Whether a list shares its cells with another, see lval_slice */
+static inline int lval_is_slice(LVAL* v) {
+    int t = ltype(v);
+    return (t == LVAL_SEXPR || t == LVAL_QEXPR) && v->cap == LVAL_SLICE;
+}
+
 #define LASSERT(args, cond, fmt, ...)                   \
     if (!(cond)) {                                      \
         LVAL* err = lval_err(fmt, ##__VA_ARGS__);       \
@@ -48,9 +151,20 @@ struct LVAL {
     }
 
 #define LASSERT_TYPE(func, args, index, expect)         \
-    LASSERT(args, args->cell[index]->type == expect,    \
+    LASSERT(args, ltype(args->cell[index]) == expect,   \
+        "Function '%s' passed incorrect type for argument %i. Got %s, expected %s.", \
+        func, index + 1, ltype_name(ltype(args->cell[index])), ltype_name(expect))
+
+/* Any kind of number: an integer, big or not, or a float */
+static inline int lval_is_number(LVAL* v) {
+    int t = ltype(v);
+    return t == LVAL_NUM || t == LVAL_BIG || t == LVAL_FLT;
+}
+
+#define LASSERT_NUMBER(func, args, index)               \
+    LASSERT(args, lval_is_number(args->cell[index]),    \
         "Function '%s' passed incorrect type for argument %i. Got %s, expected %s.", \
-        func, index + 1, ltype_name(args->cell[index]->type), ltype_name(expect))
+        func, index + 1, ltype_name(ltype(args->cell[index])), ltype_name(LVAL_NUM))
 
 #define LASSERT_NUM(func, args, num)                    \
     LASSERT(args, args->count == num,                   \
@@ -62,8 +176,13 @@ struct LVAL {
     "Function '%s' passed {} for argument %i.", func, index + 1);
 
 char* ltype_name(int t);
+size_t lval_size(int t);
 
 LVAL* lval_num(long x);
+LVAL* lval_big(struct LBIG* b);
+LVAL* lval_flt(double x);
+LVAL* lval_vec(struct LVEC* v);
+double lreal(LVAL* v);
 LVAL* lval_sym(char* s);
 LVAL* lval_str(char* s);
 LVAL* lval_sexpr(void);
@@ -73,27 +192,39 @@ LVAL* lval_lambda(LVAL* formals, LVAL* body);
 LVAL* lval_err(char* fmt, ...);
 
 int   lval_eq(LVAL* x, LVAL* y);
+int   lval_same(LVAL* x, LVAL* y);
 LVAL* lval_add(LVAL* v, LVAL* x);
+void  lval_reserve(LVAL* v, int count);
 LVAL* lval_copy(LVAL* v);
+LVAL* lval_own(LVAL* v);
 void  lval_del(LVAL* v);
 LVAL* lval_pop(LVAL* v, int i);
 LVAL* lval_take(LVAL* v, int i);
 LVAL* lval_join(LVAL* x, LVAL* y);
+LVAL* lval_slice(LVAL* v, int start, int count);
 
 void lval_print_str(LVAL* v);
+void lval_print_flt(double x);
+void lval_print_vec(struct LVEC* v);
 void lval_print_expr(LVAL* v, char open, char close);
 void lval_print(LVAL* v);
 void lval_println(LVAL* v);
 
 LVAL* lval_read_num(mpc_ast_t* t);
+LVAL* lval_read_flt(mpc_ast_t* t);
 LVAL* lval_read_str(mpc_ast_t* t);
 LVAL* lval_read(mpc_ast_t* t);
 
+LVAL* lval_bind(struct LENV* e, LVAL* f, LVAL* a);
+LVAL* lval_body(LVAL* f);
 LVAL* lval_call(struct LENV* e, LVAL* f, LVAL* a);
-LVAL* lval_eval_sexpr(struct LENV* e, LVAL* v);
 LVAL* lval_eval(struct LENV* e, LVAL* v);
+LVAL* lval_eval_tree(struct LENV* e, LVAL* v);
 
 LVAL* builtin_eval(struct LENV *e, LVAL* a);
+LVAL* builtin_eval_expr(struct LENV *e, LVAL* a);
 LVAL* builtin_list(struct LENV *e, LVAL* a);
+LVAL* builtin_if(struct LENV* e, LVAL* a);
+LVAL* builtin_if_expr(struct LENV* e, LVAL* a);
 
 #endif
@@ -0,0 +1,523 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LVEC_X86
+#include <immintrin.h>
+#endif
+
+#include "lvec.h"
+
+/* Vectors */
+
+LVEC* lvec_new(int type, int count) {
+    LVEC* v = lalloc(lvec_size(count));
+    v->type = type;
+    v->count = count;
+    v->i = (int64_t*)(v + 1);
+    return v;
+}
+
+LVEC* lvec_copy(LVEC* v) {
+    LVEC* c = lvec_new(v->type, v->count);
+    memcpy(c->i, v->i, sizeof(int64_t) * v->count);
+    return c;
+}
+
+void lvec_free(LVEC* v) {
+    lfree(v, lvec_size(v->count));
+}
+
+int lvec_eq(LVEC* x, LVEC* y) {
+    if (x->type != y->type || x->count != y->count) { return 0; }
+    for (int i = 0; i < x->count; i++) {
+        if (x->type == LVAL_FLT ? x->f[i] != y->f[i] : x->i[i] != y->i[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Kernels come in up to three flavours: plain C, SSE2 and AVX2. The
+ * best the CPU has is picked the first time one is needed, falling
+ * back to a lesser one for anything missing; LISPY_SIMD=sse2 or scalar
+ * caps it, to compare them.
+ */
+
+typedef struct {
+    const char* isa;
+    int     (*isum)(const int64_t*, int, int64_t*);
+    double  (*fsum)(const double*, int);
+    double  (*fdot)(const double*, const double*, int);
+    int     (*iadd)(int64_t*, const int64_t*, const int64_t*, int);
+    void    (*fadd)(double*, const double*, const double*, int);
+    void    (*fscale)(double*, const double*, double, int);
+    int64_t (*imin)(const int64_t*, int, int);
+    double  (*fmin)(const double*, int, int);
+    int     (*ifilter_lt)(int64_t*, const int64_t*, int, int64_t);
+    int     (*ffilter_lt)(double*, const double*, int, double);
+} LVEC_KERNELS;
+
+/* Plain C */
+
+static int isum_c(const int64_t* x, int n, int64_t* r) {
+    int64_t s = 0;
+    for (int i = 0; i < n; i++) {
+        if (__builtin_add_overflow(s, x[i], &s)) { return 0; }
+    }
+    *r = s;
+    return 1;
+}
+
+static double fsum_c(const double* x, int n) {
+    double s = 0;
+    for (int i = 0; i < n; i++) { s += x[i]; }
+    return s;
+}
+
+static double fdot_c(const double* x, const double* y, int n) {
+    double s = 0;
+    for (int i = 0; i < n; i++) { s += x[i] * y[i]; }
+    return s;
+}
+
+static int iadd_c(int64_t* r, const int64_t* x, const int64_t* y, int n) {
+    for (int i = 0; i < n; i++) {
+        if (__builtin_add_overflow(x[i], y[i], &r[i])) { return 0; }
+    }
+    return 1;
+}
+
+static void fadd_c(double* r, const double* x, const double* y, int n) {
+    for (int i = 0; i < n; i++) { r[i] = x[i] + y[i]; }
+}
+
+static void fscale_c(double* r, const double* x, double k, int n) {
+    for (int i = 0; i < n; i++) { r[i] = x[i] * k; }
+}
+
+/* min and max keep the earlier element on ties, as minpd and maxpd do */
+static int64_t imin_c(const int64_t* x, int n, int max) {
+    int64_t m = x[0];
+    for (int i = 1; i < n; i++) {
+        if (max ? x[i] > m : x[i] < m) { m = x[i]; }
+    }
+    return m;
+}
+
+static double fmin_c(const double* x, int n, int max) {
+    double m = x[0];
+    for (int i = 1; i < n; i++) {
+        if (max ? x[i] > m : x[i] < m) { m = x[i]; }
+    }
+    return m;
+}
+
+static int ifilter_lt_c(int64_t* r, const int64_t* x, int n, int64_t k) {
+    int c = 0;
+    for (int i = 0; i < n; i++) {
+        if (x[i] < k) { r[c++] = x[i]; }
+    }
+    return c;
+}
+
+static int ffilter_lt_c(double* r, const double* x, int n, double k) {
+    int c = 0;
+    for (int i = 0; i < n; i++) {
+        if (x[i] < k) { r[c++] = x[i]; }
+    }
+    return c;
+}
+
+static const LVEC_KERNELS kernels_c = {
+    "scalar", isum_c, fsum_c, fdot_c, iadd_c, fadd_c, fscale_c,
+    imin_c, fmin_c, ifilter_lt_c, ffilter_lt_c
+};
+
+#ifdef LVEC_X86
+
+/*
+ * Lane-wise sums wrap on overflow, so each step also keeps the sign
+ * bits of (a ^ s) & (b ^ s), which are set just when a + b did.
+ */
+
+/* Lanes of an integer sum, added up with the rest */
+static int isum_lanes(int64_t* lanes, int nlanes, const int64_t* x, int n, int64_t* r) {
+    int64_t s;
+    if (!isum_c(x, n, &s)) { return 0; }
+    for (int i = 0; i < nlanes; i++) {
+        if (__builtin_add_overflow(s, lanes[i], &s)) { return 0; }
+    }
+    *r = s;
+    return 1;
+}
+
+/* SSE2 */
+
+__attribute__((target("sse2")))
+static int isum_sse2(const int64_t* x, int n, int64_t* r) {
+    __m128i s = _mm_setzero_si128();
+    __m128i o = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(x + i));
+        __m128i t = _mm_add_epi64(s, v);
+        o = _mm_or_si128(o, _mm_and_si128(_mm_xor_si128(s, t), _mm_xor_si128(v, t)));
+        s = t;
+    }
+    if (_mm_movemask_pd(_mm_castsi128_pd(o))) { return 0; }
+
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, s);
+    return isum_lanes(lanes, 2, x + i, n - i, r);
+}
+
+__attribute__((target("sse2")))
+static double fsum_sse2(const double* x, int n) {
+    __m128d s0 = _mm_setzero_pd();
+    __m128d s1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 = _mm_add_pd(s0, _mm_loadu_pd(x + i));
+        s1 = _mm_add_pd(s1, _mm_loadu_pd(x + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+    return lanes[0] + lanes[1] + fsum_c(x + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static double fdot_sse2(const double* x, const double* y, int n) {
+    __m128d s0 = _mm_setzero_pd();
+    __m128d s1 = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+    return lanes[0] + lanes[1] + fdot_c(x + i, y + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static int iadd_sse2(int64_t* r, const int64_t* x, const int64_t* y, int n) {
+    __m128i o = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(x + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(y + i));
+        __m128i t = _mm_add_epi64(a, b);
+        o = _mm_or_si128(o, _mm_and_si128(_mm_xor_si128(a, t), _mm_xor_si128(b, t)));
+        _mm_storeu_si128((__m128i*)(r + i), t);
+    }
+    if (_mm_movemask_pd(_mm_castsi128_pd(o))) { return 0; }
+    return iadd_c(r + i, x + i, y + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void fadd_sse2(double* r, const double* x, const double* y, int n) {
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(r + i, _mm_add_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+    }
+    fadd_c(r + i, x + i, y + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void fscale_sse2(double* r, const double* x, double k, int n) {
+    __m128d kk = _mm_set1_pd(k);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(r + i, _mm_mul_pd(_mm_loadu_pd(x + i), kk));
+    }
+    fscale_c(r + i, x + i, k, n - i);
+}
+
+__attribute__((target("sse2")))
+static double fmin_sse2(const double* x, int n, int max) {
+    if (n < 4) { return fmin_c(x, n, max); }
+    __m128d m = _mm_loadu_pd(x);
+    int i = 2;
+    for (; i + 2 <= n; i += 2) {
+        __m128d v = _mm_loadu_pd(x + i);
+        m = max ? _mm_max_pd(v, m) : _mm_min_pd(v, m);
+    }
+    double lanes[4];
+    _mm_storeu_pd(lanes, m);
+    int k = 2;
+    for (; i < n; i++) { lanes[k++] = x[i]; }
+    return fmin_c(lanes, k, max);
+}
+
+static const LVEC_KERNELS kernels_sse2 = {
+    "sse2", isum_sse2, fsum_sse2, fdot_sse2, iadd_sse2, fadd_sse2,
+    fscale_sse2, imin_c, fmin_sse2, ifilter_lt_c, ffilter_lt_c
+};
+
+/* AVX2 */
+
+__attribute__((target("avx2")))
+static int isum_avx2(const int64_t* x, int n, int64_t* r) {
+    __m256i s = _mm256_setzero_si256();
+    __m256i o = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(x + i));
+        __m256i t = _mm256_add_epi64(s, v);
+        o = _mm256_or_si256(o, _mm256_and_si256(_mm256_xor_si256(s, t),
+                                                _mm256_xor_si256(v, t)));
+        s = t;
+    }
+    if (_mm256_movemask_pd(_mm256_castsi256_pd(o))) { return 0; }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, s);
+    return isum_lanes(lanes, 4, x + i, n - i, r);
+}
+
+__attribute__((target("avx2")))
+static double fsum_avx2(const double* x, int n) {
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        s0 = _mm256_add_pd(s0, _mm256_loadu_pd(x + i));
+        s1 = _mm256_add_pd(s1, _mm256_loadu_pd(x + i + 4));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(s0, s1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + fsum_c(x + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static double fdot_avx2(const double* x, const double* y, int n) {
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(x + i),
+                                             _mm256_loadu_pd(y + i)));
+        s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4),
+                                             _mm256_loadu_pd(y + i + 4)));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(s0, s1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + fdot_c(x + i, y + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int iadd_avx2(int64_t* r, const int64_t* x, const int64_t* y, int n) {
+    __m256i o = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(x + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(y + i));
+        __m256i t = _mm256_add_epi64(a, b);
+        o = _mm256_or_si256(o, _mm256_and_si256(_mm256_xor_si256(a, t),
+                                                _mm256_xor_si256(b, t)));
+        _mm256_storeu_si256((__m256i*)(r + i), t);
+    }
+    if (_mm256_movemask_pd(_mm256_castsi256_pd(o))) { return 0; }
+    return iadd_c(r + i, x + i, y + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void fadd_avx2(double* r, const double* x, const double* y, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(r + i, _mm256_add_pd(_mm256_loadu_pd(x + i),
+                                              _mm256_loadu_pd(y + i)));
+    }
+    fadd_c(r + i, x + i, y + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void fscale_avx2(double* r, const double* x, double k, int n) {
+    __m256d kk = _mm256_set1_pd(k);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(r + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), kk));
+    }
+    fscale_c(r + i, x + i, k, n - i);
+}
+
+/* No 64-bit integer min or max before AVX-512, so compare and blend */
+__attribute__((target("avx2")))
+static int64_t imin_avx2(const int64_t* x, int n, int max) {
+    if (n < 8) { return imin_c(x, n, max); }
+    __m256i m = _mm256_loadu_si256((const __m256i*)x);
+    int i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(x + i));
+        __m256i better = max ? _mm256_cmpgt_epi64(v, m) : _mm256_cmpgt_epi64(m, v);
+        m = _mm256_blendv_epi8(m, v, better);
+    }
+    int64_t lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, m);
+    int k = 4;
+    for (; i < n; i++) { lanes[k++] = x[i]; }
+    return imin_c(lanes, k, max);
+}
+
+__attribute__((target("avx2")))
+static double fmin_avx2(const double* x, int n, int max) {
+    if (n < 8) { return fmin_c(x, n, max); }
+    __m256d m = _mm256_loadu_pd(x);
+    int i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_loadu_pd(x + i);
+        m = max ? _mm256_max_pd(v, m) : _mm256_min_pd(v, m);
+    }
+    double lanes[8];
+    _mm256_storeu_pd(lanes, m);
+    int k = 4;
+    for (; i < n; i++) { lanes[k++] = x[i]; }
+    return fmin_c(lanes, k, max);
+}
+
+/*
+ * Filters compare four at a time, then move the ones kept to the front
+ * with a permute picked by the comparison's mask, and store all four;
+ * the next store overwrites those not kept.
+ */
+static int32_t compress[16][8];
+
+static void compress_init(void) {
+    for (int m = 0; m < 16; m++) {
+        int k = 0;
+        for (int j = 0; j < 4; j++) {
+            if (m & (1 << j)) {
+                compress[m][k++] = 2*j;
+                compress[m][k++] = 2*j + 1;
+            }
+        }
+        while (k < 8) { compress[m][k++] = 0; }
+    }
+}
+
+__attribute__((target("avx2")))
+static int ifilter_lt_avx2(int64_t* r, const int64_t* x, int n, int64_t k) {
+    __m256i kk = _mm256_set1_epi64x(k);
+    int c = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(x + i));
+        int m = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(kk, v)));
+        __m256i p = _mm256_loadu_si256((const __m256i*)compress[m]);
+        _mm256_storeu_si256((__m256i*)(r + c), _mm256_permutevar8x32_epi32(v, p));
+        c += __builtin_popcount(m);
+    }
+    return c + ifilter_lt_c(r + c, x + i, n - i, k);
+}
+
+__attribute__((target("avx2")))
+static int ffilter_lt_avx2(double* r, const double* x, int n, double k) {
+    __m256d kk = _mm256_set1_pd(k);
+    int c = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d v = _mm256_loadu_pd(x + i);
+        int m = _mm256_movemask_pd(_mm256_cmp_pd(v, kk, _CMP_LT_OQ));
+        __m256i p = _mm256_loadu_si256((const __m256i*)compress[m]);
+        __m256i t = _mm256_permutevar8x32_epi32(_mm256_castpd_si256(v), p);
+        _mm256_storeu_pd(r + c, _mm256_castsi256_pd(t));
+        c += __builtin_popcount(m);
+    }
+    return c + ffilter_lt_c(r + c, x + i, n - i, k);
+}
+
+static const LVEC_KERNELS kernels_avx2 = {
+    "avx2", isum_avx2, fsum_avx2, fdot_avx2, iadd_avx2, fadd_avx2,
+    fscale_avx2, imin_avx2, fmin_avx2, ifilter_lt_avx2, ffilter_lt_avx2
+};
+
+#endif
+
+static const LVEC_KERNELS* kernels;
+
+static const LVEC_KERNELS* pick(void) {
+    if (kernels) { return kernels; }
+    kernels = &kernels_c;
+
+#ifdef LVEC_X86
+    char* cap = getenv("LISPY_SIMD");
+    int scalar = cap && strcmp(cap, "scalar") == 0;
+    int sse2 = cap && strcmp(cap, "sse2") == 0;
+
+    __builtin_cpu_init();
+    if (!scalar && __builtin_cpu_supports("sse2")) { kernels = &kernels_sse2; }
+    if (!scalar && !sse2 && __builtin_cpu_supports("avx2")) {
+        compress_init();
+        kernels = &kernels_avx2;
+    }
+#endif
+
+    return kernels;
+}
+
+const char* lvec_isa(void) {
+    return pick()->isa;
+}
+
+int lvec_isum(const int64_t* x, int n, int64_t* r) {
+    return pick()->isum(x, n, r);
+}
+
+double lvec_fsum(const double* x, int n) {
+    return pick()->fsum(x, n);
+}
+
+/* No 64-bit integer multiply before AVX-512 either */
+int lvec_idot(const int64_t* x, const int64_t* y, int n, int64_t* r) {
+    int64_t s = 0;
+    for (int i = 0; i < n; i++) {
+        int64_t p;
+        if (__builtin_mul_overflow(x[i], y[i], &p) ||
+            __builtin_add_overflow(s, p, &s)) {
+            return 0;
+        }
+    }
+    *r = s;
+    return 1;
+}
+
+double lvec_fdot(const double* x, const double* y, int n) {
+    return pick()->fdot(x, y, n);
+}
+
+int lvec_iadd(int64_t* r, const int64_t* x, const int64_t* y, int n) {
+    return pick()->iadd(r, x, y, n);
+}
+
+void lvec_fadd(double* r, const double* x, const double* y, int n) {
+    pick()->fadd(r, x, y, n);
+}
+
+int lvec_iscale(int64_t* r, const int64_t* x, int64_t k, int n) {
+    for (int i = 0; i < n; i++) {
+        if (__builtin_mul_overflow(x[i], k, &r[i])) { return 0; }
+    }
+    return 1;
+}
+
+void lvec_fscale(double* r, const double* x, double k, int n) {
+    pick()->fscale(r, x, k, n);
+}
+
+int64_t lvec_imin(const int64_t* x, int n, int max) {
+    return pick()->imin(x, n, max);
+}
+
+double lvec_fmin(const double* x, int n, int max) {
+    return pick()->fmin(x, n, max);
+}
+
+int lvec_ifilter_lt(int64_t* r, const int64_t* x, int n, int64_t k) {
+    return pick()->ifilter_lt(r, x, n, k);
+}
+
+int lvec_ffilter_lt(double* r, const double* x, int n, double k) {
+    return pick()->ffilter_lt(r, x, n, k);
+}
@@ -0,0 +1,51 @@
+#ifndef lvec_h
+#define lvec_h
+
+#include <stdint.h>
+
+#include "lval.h"
+
+/*
+ * A packed vector of numbers, all integers (LVAL_NUM) or all floats
+ * (LVAL_FLT), stored inline after the header.
+ */
+typedef struct LVEC {
+    int type;
+    int count;
+    union {
+        int64_t* i;
+        double* f;
+    };
+} LVEC;
+
+static inline size_t lvec_size(int count) {
+    return sizeof(LVEC) + sizeof(int64_t) * count;
+}
+
+LVEC* lvec_new(int type, int count);
+LVEC* lvec_copy(LVEC* v);
+void  lvec_free(LVEC* v);
+int   lvec_eq(LVEC* x, LVEC* y);
+
+/* Instruction set the kernels below were picked for */
+const char* lvec_isa(void);
+
+/*
+ * Kernels, each the fastest the CPU runs. Integer ones return 0 if
+ * they overflowed, possibly only part way through. Filters return the
+ * count kept, and need room in r for n + 4.
+ */
+int     lvec_isum(const int64_t* x, int n, int64_t* r);
+double  lvec_fsum(const double* x, int n);
+int     lvec_idot(const int64_t* x, const int64_t* y, int n, int64_t* r);
+double  lvec_fdot(const double* x, const double* y, int n);
+int     lvec_iadd(int64_t* r, const int64_t* x, const int64_t* y, int n);
+void    lvec_fadd(double* r, const double* x, const double* y, int n);
+int     lvec_iscale(int64_t* r, const int64_t* x, int64_t k, int n);
+void    lvec_fscale(double* r, const double* x, double k, int n);
+int64_t lvec_imin(const int64_t* x, int n, int max);
+double  lvec_fmin(const double* x, int n, int max);
+int     lvec_ifilter_lt(int64_t* r, const int64_t* x, int n, int64_t k);
+int     lvec_ffilter_lt(double* r, const double* x, int n, double k);
+
+#endif
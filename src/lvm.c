@@ -0,0 +1,978 @@
+#include "lvm.h"
+#include "lgc.h"
+#include "leval.h"
+#include "builtin.h"
+
+/*
+ * Bytecode and closure engines.
+ *
+ * A lambda body is compiled the first time the lambda is called, and
+ * the code is shared by every copy of the lambda from then on. Formals
+ * become frame slots, if with literal branches becomes jumps, and
+ * binary arithmetic on the builtins becomes a single instruction.
+ * Everything else is looked up and called the same way the tree walker
+ * does it, so scoping stays dynamic.
+ *
+ * The closure engine compiles the same things to a tree of nodes
+ * instead, each a C function specialised for its job, that call each
+ * other directly. Frames and calls work the same for both.
+ *
+ * A frame keeps its slots on the value stack, with the names bound as
+ * far as lookups are concerned, and is only turned into an env parented
+ * to its caller's once something needs one: a builtin call, a lookup
+ * the global cache can't answer, or a tail call that must keep it.
+ *
+ * Specialised instructions are guarded by the version of the name they
+ * stand for, and fall back to a normal call once it has been rebound.
+ */
+
+enum {
+    OP_CONST,       /* k: push constant k */
+    OP_LOCAL,       /* i: push frame slot i */
+    OP_LOOKUP,      /* k: push the value of symbol constant k */
+    OP_CALL,        /* n: call the n values on top, function first */
+    OP_TAILCALL,    /* n: the same, returning the result */
+    OP_IF,          /* g then else else_pc end_pc: branch on the top value */
+    OP_JUMP,        /* pc */
+    OP_ARITH,       /* op g: combine the two values on top */
+    OP_ARITH_RK,    /* op g x y: combine two slots or constants */
+    OP_RET          /* return the top value */
+};
+
+enum { AR_ADD, AR_SUB, AR_MUL, AR_LT, AR_GT, AR_LE, AR_GE, AR_EQ, AR_NE };
+
+static const struct {
+    LBUILTIN builtin;
+    int op;
+} arith[] = {
+    { builtin_add, AR_ADD }, { builtin_sub, AR_SUB }, { builtin_mul, AR_MUL },
+    { builtin_lt,  AR_LT },  { builtin_gt,  AR_GT },  { builtin_le,  AR_LE },
+    { builtin_ge,  AR_GE },  { builtin_eq,  AR_EQ },  { builtin_ne,  AR_NE },
+};
+
+/* Value stack, shared by nested runs */
+static LVAL** stack;
+static long sp;
+static long cap;
+
+static long depth;
+
+/* Compiler */
+
+typedef struct {
+    LCODE* c;
+    int capcode;
+    int capconsts;
+    int capguards;
+    int height;
+    int nnames;
+    LENV* global;
+} LCOMP;
+
+static void emit(LCOMP* C, int x) {
+    LCODE* c = C->c;
+    if (c->ncode == C->capcode) {
+        C->capcode = C->capcode ? 2 * C->capcode : 64;
+        c->code = realloc(c->code, sizeof(int) * C->capcode);
+    }
+    c->code[c->ncode++] = x;
+}
+
+static void height(LCOMP* C, int delta) {
+    C->height += delta;
+    if (C->height > C->c->maxstack) { C->c->maxstack = C->height; }
+}
+
+/* Constants are kept out of any region, as the code outlives it */
+static int constant(LCOMP* C, LVAL* v) {
+    LCODE* c = C->c;
+    if (c->nconsts == C->capconsts) {
+        C->capconsts = C->capconsts ? 2 * C->capconsts : 16;
+        c->consts = realloc(c->consts, sizeof(LVAL*) * C->capconsts);
+    }
+    c->consts[c->nconsts] = lgc_tenure(v);
+    return c->nconsts++;
+}
+
+static int slot(LCOMP* C, char* sym) {
+    for (int i = 0; i < C->nnames; i++) {
+        if (C->c->names[i] == sym) { return i; }
+    }
+    return -1;
+}
+
+/* The builtin a global name is bound to, if it's bound nowhere else */
+static LBUILTIN global_builtin(LCOMP* C, LVAL* x) {
+    if (ltype(x) != LVAL_SYM || slot(C, x->sym) >= 0) { return NULL; }
+    if (lsym_of(x->sym)->binds != 1) { return NULL; }
+
+    LVAL* f = lenv_get(C->global, x);
+    LBUILTIN b = ltype(f) == LVAL_FUN ? f->builtin : NULL;
+    lval_del(f);
+    return b;
+}
+
+static int guard(LCOMP* C, LVAL* sym, LBUILTIN b) {
+    LCODE* c = C->c;
+    if (c->nguards == C->capguards) {
+        C->capguards = C->capguards ? 2 * C->capguards : 8;
+        c->guards = realloc(c->guards, sizeof(LGUARD) * C->capguards);
+    }
+    c->guards[c->nguards] = (LGUARD){ lval_sym(sym->sym), b,
+                                      lsym_of(sym->sym)->version };
+    return c->nguards++;
+}
+
+/* Slots are operands i >= 0, constants k are -(k + 1) */
+#define NO_OPERAND INT_MIN
+
+static int operand(LCOMP* C, LVAL* x) {
+    if (ltype(x) == LVAL_NUM) { return -constant(C, x) - 1; }
+    if (ltype(x) != LVAL_SYM) { return NO_OPERAND; }
+    int i = slot(C, x->sym);
+    return i >= 0 ? i : NO_OPERAND;
+}
+
+static void compile_expr(LCOMP* C, LVAL* x, int tail);
+static struct LNODE* build_seq(LCOMP* C, LVAL* x, int tail);
+static void free_node(struct LNODE* n);
+
+/* Elements of an expression, evaluated the way a sexpr is */
+static void compile_seq(LCOMP* C, LVAL* x, int tail) {
+    if (x->count == 0) {
+        LVAL* empty = lval_sexpr();
+        emit(C, OP_CONST); emit(C, constant(C, empty)); height(C, 1);
+        lval_del(empty);
+        if (tail) { emit(C, OP_RET); }
+        return;
+    }
+    if (x->count == 1) {
+        compile_expr(C, x->cell[0], tail);
+        return;
+    }
+
+    LBUILTIN b = global_builtin(C, x->cell[0]);
+
+    /* (if c {then} {else}) */
+    if (b == builtin_if && x->count == 4 &&
+        ltype(x->cell[2]) == LVAL_QEXPR && ltype(x->cell[3]) == LVAL_QEXPR) {
+        compile_expr(C, x->cell[1], 0);
+        emit(C, OP_IF);
+        emit(C, guard(C, x->cell[0], b));
+        emit(C, constant(C, x->cell[2]));
+        emit(C, constant(C, x->cell[3]));
+        int at = C->c->ncode;
+        emit(C, 0);
+        emit(C, 0);
+        height(C, -1);
+        int h = C->height;
+
+        compile_seq(C, x->cell[2], tail);
+        int jump = -1;
+        if (!tail) {
+            emit(C, OP_JUMP);
+            jump = C->c->ncode;
+            emit(C, 0);
+        }
+
+        C->height = h;
+        C->c->code[at] = C->c->ncode;
+        compile_seq(C, x->cell[3], tail);
+
+        C->height = h + 1;
+        C->c->code[at + 1] = C->c->ncode;
+        if (tail) { emit(C, OP_RET); }
+        else { C->c->code[jump] = C->c->ncode; }
+        return;
+    }
+
+    /* Binary arithmetic and comparison */
+    for (int i = 0; b && x->count == 3 && i < sizeof(arith) / sizeof(arith[0]); i++) {
+        if (arith[i].builtin != b) { continue; }
+
+        int ax = operand(C, x->cell[1]);
+        int ay = operand(C, x->cell[2]);
+        if (ax != NO_OPERAND && ay != NO_OPERAND) {
+            emit(C, OP_ARITH_RK);
+            emit(C, arith[i].op);
+            emit(C, guard(C, x->cell[0], b));
+            emit(C, ax);
+            emit(C, ay);
+            height(C, 1);
+            if (tail) { emit(C, OP_RET); }
+            return;
+        }
+
+        compile_expr(C, x->cell[1], 0);
+        compile_expr(C, x->cell[2], 0);
+        emit(C, OP_ARITH);
+        emit(C, arith[i].op);
+        emit(C, guard(C, x->cell[0], b));
+        height(C, -1);
+        if (tail) { emit(C, OP_RET); }
+        return;
+    }
+
+    /* Anything else is a call */
+    for (int i = 0; i < x->count; i++) { compile_expr(C, x->cell[i], 0); }
+    emit(C, tail ? OP_TAILCALL : OP_CALL);
+    emit(C, x->count);
+    height(C, 1 - x->count);
+}
+
+static void compile_expr(LCOMP* C, LVAL* x, int tail) {
+    switch (ltype(x)) {
+    case LVAL_SYM: {
+        int i = slot(C, x->sym);
+        if (i >= 0) {
+            emit(C, OP_LOCAL); emit(C, i);
+        } else {
+            LVAL* sym = lval_sym(x->sym);
+            emit(C, OP_LOOKUP); emit(C, constant(C, sym));
+            lval_del(sym);
+        }
+        height(C, 1);
+        break;
+    }
+
+    case LVAL_SEXPR:
+        compile_seq(C, x, tail);
+        return;
+
+    default:
+        emit(C, OP_CONST); emit(C, constant(C, x));
+        height(C, 1);
+        break;
+    }
+
+    if (tail) { emit(C, OP_RET); }
+}
+
+/* Slots are the bound names followed by the remaining formals */
+static LCODE* compile(LVAL* f, LENV* e) {
+    LCODE* c = calloc(1, sizeof(LCODE));
+    c->refs = 1;
+    c->simple = 1;
+
+    LCOMP C = { c, 0, 0, 0, 0, 0, e };
+    while (C.global->parent) { C.global = C.global->parent; }
+
+    c->names = malloc(sizeof(char*) * (f->env->count + f->formals->count));
+    for (int i = 0; i < f->env->count; i++) {
+        c->names[C.nnames++] = f->env->syms[i];
+    }
+    for (int i = 0; i < f->formals->count; i++) {
+        char* sym = f->formals->cell[i]->sym;
+        if (sym == lsym_amp) { c->simple = 0; continue; }
+
+        /* A repeated formal rebinds its slot, which code can't follow */
+        if (slot(&C, sym) >= 0) { return c; }
+        c->names[C.nnames++] = sym;
+    }
+    c->nslots = C.nnames;
+
+    lalloc_region_suspend();
+    if (leval_engine == LEVAL_CLOSURE) {
+        c->tree = build_seq(&C, f->body, 1);
+    } else {
+        compile_seq(&C, f->body, 1);
+    }
+    lalloc_region_resume();
+
+    c->ok = 1;
+    return c;
+}
+
+/* The lambda's code, compiling it on first use, or NULL if it can't be */
+LCODE* lvm_code(LVAL* f, LENV* e) {
+    if (!f->code) { f->code = compile(f, e); }
+    return f->code->ok ? f->code : NULL;
+}
+
+void lvm_release(LCODE* c) {
+    if (!c || --c->refs > 0) { return; }
+
+    for (int i = 0; i < c->nconsts; i++) { lval_del(c->consts[i]); }
+    for (int i = 0; i < c->nguards; i++) { lval_del(c->guards[i].sym); }
+    if (c->tree) { free_node(c->tree); }
+    free(c->names);
+    free(c->code);
+    free(c->consts);
+    free(c->guards);
+    free(c);
+}
+
+void lvm_cleanup(void) {
+    free(stack);
+    stack = NULL;
+    sp = cap = 0;
+}
+
+
+/* Interpreter */
+
+/* A running frame, whose slots stay on the stack until it needs an env */
+typedef struct LFRAME {
+    LCODE* c;
+    long base;              /* first slot */
+    LENV* env;              /* the frame as an env, once it has one */
+    struct LFRAME* up;      /* caller, if it's a frame of ours */
+    LENV* parent;           /* otherwise the caller's env */
+} LFRAME;
+
+static void grow(long n) {
+    while (cap < sp + n) { cap = cap ? 2 * cap : 1024; }
+    stack = realloc(stack, sizeof(LVAL*) * cap);
+}
+
+static inline void reserve(long n) {
+    if (sp + n > cap) { grow(n); }
+}
+
+/* Most values on the stack are fixnums, which need no lval_del */
+static inline void drop(LVAL* v) {
+    if (!lval_is_fixnum(v)) { lval_del(v); }
+}
+
+static void bind_slots(LCODE* c) {
+    for (int i = 0; i < c->nslots; i++) { lsym_bind(c->names[i]); }
+}
+
+static void unbind_slots(LCODE* c) {
+    for (int i = 0; i < c->nslots; i++) { lsym_unbind(c->names[i]); }
+}
+
+/* The frame as an env, moving its slots and its callers' into envs */
+static LENV* frame_env(LFRAME* fr) {
+    if (fr->env) { return fr->env; }
+
+    LENV* parent = fr->up ? frame_env(fr->up) : fr->parent;
+    fr->env = lenv_frame(fr->c->names, &stack[fr->base], fr->c->nslots);
+    fr->env->parent = parent;
+
+    unbind_slots(fr->c);
+    for (int i = 0; i < fr->c->nslots; i++) {
+        stack[fr->base + i] = lval_fixnum(0);
+    }
+    return fr->env;
+}
+
+static LENV* frame_root(LFRAME* fr) {
+    while (fr->up) { fr = fr->up; }
+    LENV* e = fr->env ? fr->env : fr->parent;
+    while (e->parent) { e = e->parent; }
+    return e;
+}
+
+/* Whether every name in the frame is one the callee's slots hide */
+static int frame_shadowed(LFRAME* fr, LCODE* callee) {
+    if (!fr->env && fr->c == callee) { return 1; }
+
+    char** names = fr->env ? fr->env->syms : fr->c->names;
+    int n = fr->env ? fr->env->count : fr->c->nslots;
+    for (int i = 0; i < n; i++) {
+        int found = 0;
+        for (int j = 0; j < callee->nslots && !found; j++) {
+            found = callee->names[j] == names[i];
+        }
+        if (!found) { return 0; }
+    }
+    return 1;
+}
+
+static inline LVAL* operand_val(LFRAME* fr, int a) {
+    if (a < 0) { return fr->c->consts[-a - 1]; }
+    return fr->env ? fr->env->vals[a] : stack[fr->base + a];
+}
+
+/* A lookup, without making the frame an env if the global cache has it */
+static LVAL* lookup(LFRAME* fr, LVAL* k) {
+    return lenv_get(lenv_cached(k) ? NULL : frame_env(fr), k);
+}
+
+/* Whether a guarded builtin is still what its name is bound to */
+static int guard_refresh(LFRAME* fr, LGUARD* g) {
+    LSYM* s = lsym_of(g->sym->sym);
+    LVAL* f = lookup(fr, g->sym);
+    int holds = s->binds == 1 && ltype(f) == LVAL_FUN && f->builtin == g->builtin;
+    lval_del(f);
+
+    if (holds) { g->version = s->version; }
+    return holds;
+}
+
+static inline int guard_holds(LFRAME* fr, LGUARD* g) {
+    return lsym_of(g->sym->sym)->version == g->version || guard_refresh(fr, g);
+}
+
+static LVAL* run(LCODE* c, long base, LENV* env, LFRAME* up, LENV* parent);
+
+/* Lambdas whose code can take n arguments straight into slots */
+static LCODE* fast_code(LVAL* f, LFRAME* fr, int n) {
+    if (f->builtin || f->formals->count != n) { return NULL; }
+    LCODE* c = f->code ? (f->code->ok ? f->code : NULL)
+                       : lvm_code(f, frame_root(fr));
+    return c && c->simple ? c : NULL;
+}
+
+/*
+ * Turn the function and n - 1 arguments at s into the slots of its
+ * frame, the names it already has bound followed by the arguments.
+ */
+static inline void enter_slots(long s, LVAL* f, int n) {
+    int k = f->env->count;
+    if (k == 0) {
+        for (int i = 1; i < n; i++) { stack[s + i - 1] = stack[s + i]; }
+        sp = s + n - 1;
+        return;
+    }
+
+    reserve(k);
+    memmove(&stack[s + k], &stack[s + 1], sizeof(LVAL*) * (n - 1));
+    for (int i = 0; i < k; i++) { stack[s + i] = lval_ref(f->env->vals[i]); }
+    sp = s + k + n - 1;
+}
+
+/* Call the function and arguments on top of the stack, consuming them */
+static LVAL* call(LFRAME* fr, int n) {
+    long s = sp - n;
+
+    for (int i = 0; i < n; i++) {
+        if (ltype(stack[s + i]) != LVAL_ERR) { continue; }
+        LVAL* err = stack[s + i];
+        for (int j = 0; j < n; j++) { if (j != i) { lval_del(stack[s + j]); } }
+        sp = s;
+        return err;
+    }
+
+    LVAL* f = stack[s];
+    if (ltype(f) != LVAL_FUN) {
+        LVAL* err = lval_err(
+            "S-Expression starts with incorrect type. "
+            "Got %s, expected %s.",
+            ltype_name(ltype(f)), ltype_name(LVAL_FUN));
+        for (int j = 0; j < n; j++) { lval_del(stack[s + j]); }
+        sp = s;
+        return err;
+    }
+
+    LCODE* c = fast_code(f, fr, n - 1);
+    if (c) {
+        enter_slots(s, f, n);
+        c->refs++;
+        lval_del(f);
+        return run(c, s, NULL, fr, NULL);
+    }
+
+    LVAL* a = lval_sexpr();
+    lval_reserve(a, n - 1);
+    a->count = n - 1;
+    memcpy(a->cell, &stack[s + 1], sizeof(LVAL*) * a->count);
+    sp = s;
+
+    LENV* e = frame_env(fr);
+    if (f->builtin) {
+        LVAL* r = f->builtin(e, a);
+        lval_del(f);
+        return r;
+    }
+    return lvm_apply(e, f, a);
+}
+
+/* A call through the name's current binding, for failed guards */
+static LVAL* slow_call(LFRAME* fr, LGUARD* g, LVAL** args, int n) {
+    LVAL* f = lookup(fr, g->sym);
+    reserve(n + 1);
+    stack[sp++] = f;
+    for (int i = 0; i < n; i++) { stack[sp++] = args[i]; }
+    return call(fr, n + 1);
+}
+
+static inline LVAL* arith_op(int op, long x, long y, int* ok) {
+    long r;
+    switch (op) {
+    case AR_ADD: return lval_num(x + y);
+    case AR_SUB: return lval_num(x - y);
+    case AR_MUL:
+        if (__builtin_mul_overflow(x, y, &r)) { *ok = 0; return NULL; }
+        return lval_num(r);
+    case AR_LT: return lval_fixnum(x < y);
+    case AR_GT: return lval_fixnum(x > y);
+    case AR_LE: return lval_fixnum(x <= y);
+    case AR_GE: return lval_fixnum(x >= y);
+    case AR_EQ: return lval_fixnum(x == y);
+    case AR_NE: return lval_fixnum(x != y);
+    }
+    *ok = 0;
+    return NULL;
+}
+
+/* Closure trees */
+
+typedef LVAL* (*LNODE_FN)(struct LNODE* n, LFRAME* fr);
+
+typedef struct LNODE {
+    LNODE_FN fn;
+    int a, b;           /* operands or constants, by node */
+    int g;              /* guard */
+    int count;
+    struct LNODE** kids;
+} LNODE;
+
+/* Returned by a tail call node, which leaves the call on the stack */
+static LVAL tail_mark;
+static int tail_n;
+
+static LVAL* node_const(LNODE* n, LFRAME* fr) {
+    return lval_ref(fr->c->consts[n->a]);
+}
+
+static LVAL* node_local(LNODE* n, LFRAME* fr) {
+    return lval_ref(operand_val(fr, n->a));
+}
+
+static LVAL* node_lookup(LNODE* n, LFRAME* fr) {
+    return lookup(fr, fr->c->consts[n->a]);
+}
+
+/* Push the values of the kids, ready for a call */
+static inline void push_kids(LNODE* n, LFRAME* fr) {
+    reserve(n->count);
+    for (int i = 0; i < n->count; i++) {
+        LVAL* v = n->kids[i]->fn(n->kids[i], fr);
+        stack[sp++] = v;
+    }
+}
+
+static LVAL* node_call(LNODE* n, LFRAME* fr) {
+    push_kids(n, fr);
+    return call(fr, n->count);
+}
+
+static LVAL* node_tailcall(LNODE* n, LFRAME* fr) {
+    push_kids(n, fr);
+    tail_n = n->count;
+    return &tail_mark;
+}
+
+/* If on a number, going straight to the branch's code */
+static LVAL* node_if(LNODE* n, LFRAME* fr) {
+    LGUARD* g = &fr->c->guards[n->g];
+    LVAL* cond = n->kids[0]->fn(n->kids[0], fr);
+
+    if (ltype(cond) == LVAL_NUM && guard_holds(fr, g)) {
+        LNODE* k = n->kids[lnum(cond) != 0 ? 1 : 2];
+        drop(cond);
+        return k->fn(k, fr);
+    }
+
+    LVAL* args[3] = { cond, lval_ref(fr->c->consts[n->a]),
+                      lval_ref(fr->c->consts[n->b]) };
+    return slow_call(fr, g, args, 3);
+}
+
+/* Arithmetic on x and y, taking them over if owned */
+static inline LVAL* arith_node(LNODE* n, LFRAME* fr, int op,
+                               LVAL* x, LVAL* y, int owned) {
+    LGUARD* g = &fr->c->guards[n->g];
+    int ok = lval_is_fixnum(x) && lval_is_fixnum(y) && guard_holds(fr, g);
+    LVAL* v = ok ? arith_op(op, lnum(x), lnum(y), &ok) : NULL;
+    if (ok) { return v; }
+
+    LVAL* args[2] = { owned ? x : lval_ref(x), owned ? y : lval_ref(y) };
+    return slow_call(fr, g, args, 2);
+}
+
+/* For each operation, one node on two slots or constants, one on kids */
+#define ARITH_NODES(name, op)                                           \
+    static LVAL* name##_rk(LNODE* n, LFRAME* fr) {                      \
+        return arith_node(n, fr, op, operand_val(fr, n->a),             \
+                          operand_val(fr, n->b), 0);                    \
+    }                                                                   \
+    static LVAL* name##_kids(LNODE* n, LFRAME* fr) {                    \
+        LVAL* x = n->kids[0]->fn(n->kids[0], fr);                       \
+        LVAL* y = n->kids[1]->fn(n->kids[1], fr);                       \
+        return arith_node(n, fr, op, x, y, 1);                          \
+    }
+
+ARITH_NODES(node_add, AR_ADD)
+ARITH_NODES(node_sub, AR_SUB)
+ARITH_NODES(node_mul, AR_MUL)
+ARITH_NODES(node_lt, AR_LT)
+ARITH_NODES(node_gt, AR_GT)
+ARITH_NODES(node_le, AR_LE)
+ARITH_NODES(node_ge, AR_GE)
+ARITH_NODES(node_eq, AR_EQ)
+ARITH_NODES(node_ne, AR_NE)
+
+/* Indexed by AR_ op */
+static const struct {
+    LNODE_FN rk;
+    LNODE_FN kids;
+} arith_nodes[] = {
+    { node_add_rk, node_add_kids }, { node_sub_rk, node_sub_kids },
+    { node_mul_rk, node_mul_kids }, { node_lt_rk,  node_lt_kids },
+    { node_gt_rk,  node_gt_kids },  { node_le_rk,  node_le_kids },
+    { node_ge_rk,  node_ge_kids },  { node_eq_rk,  node_eq_kids },
+    { node_ne_rk,  node_ne_kids },
+};
+
+static LNODE* node(LNODE_FN fn, int count) {
+    LNODE* n = calloc(1, sizeof(LNODE));
+    n->fn = fn;
+    n->count = count;
+    n->kids = count ? calloc(count, sizeof(LNODE*)) : NULL;
+    return n;
+}
+
+static void free_node(LNODE* n) {
+    for (int i = 0; i < n->count; i++) { free_node(n->kids[i]); }
+    free(n->kids);
+    free(n);
+}
+
+static LNODE* build_expr(LCOMP* C, LVAL* x, int tail) {
+    LNODE* n;
+    switch (ltype(x)) {
+    case LVAL_SYM: {
+        int i = slot(C, x->sym);
+        if (i >= 0) {
+            n = node(node_local, 0);
+            n->a = i;
+        } else {
+            LVAL* sym = lval_sym(x->sym);
+            n = node(node_lookup, 0);
+            n->a = constant(C, sym);
+            lval_del(sym);
+        }
+        return n;
+    }
+
+    case LVAL_SEXPR:
+        return build_seq(C, x, tail);
+
+    default:
+        n = node(node_const, 0);
+        n->a = constant(C, x);
+        return n;
+    }
+}
+
+/* The tree for what compile_seq makes bytecode for */
+static LNODE* build_seq(LCOMP* C, LVAL* x, int tail) {
+    LNODE* n;
+    if (x->count == 0) {
+        LVAL* empty = lval_sexpr();
+        n = node(node_const, 0);
+        n->a = constant(C, empty);
+        lval_del(empty);
+        return n;
+    }
+    if (x->count == 1) { return build_expr(C, x->cell[0], tail); }
+
+    LBUILTIN b = global_builtin(C, x->cell[0]);
+
+    if (b == builtin_if && x->count == 4 &&
+        ltype(x->cell[2]) == LVAL_QEXPR && ltype(x->cell[3]) == LVAL_QEXPR) {
+        n = node(node_if, 3);
+        n->g = guard(C, x->cell[0], b);
+        n->a = constant(C, x->cell[2]);
+        n->b = constant(C, x->cell[3]);
+        n->kids[0] = build_expr(C, x->cell[1], 0);
+        n->kids[1] = build_seq(C, x->cell[2], tail);
+        n->kids[2] = build_seq(C, x->cell[3], tail);
+        return n;
+    }
+
+    for (int i = 0; b && x->count == 3 && i < sizeof(arith) / sizeof(arith[0]); i++) {
+        if (arith[i].builtin != b) { continue; }
+
+        int ax = operand(C, x->cell[1]);
+        int ay = operand(C, x->cell[2]);
+        if (ax != NO_OPERAND && ay != NO_OPERAND) {
+            n = node(arith_nodes[arith[i].op].rk, 0);
+            n->a = ax;
+            n->b = ay;
+        } else {
+            n = node(arith_nodes[arith[i].op].kids, 2);
+            n->kids[0] = build_expr(C, x->cell[1], 0);
+            n->kids[1] = build_expr(C, x->cell[2], 0);
+        }
+        n->g = guard(C, x->cell[0], b);
+        return n;
+    }
+
+    n = node(tail ? node_tailcall : node_call, x->count);
+    for (int i = 0; i < x->count; i++) {
+        n->kids[i] = build_expr(C, x->cell[i], 0);
+    }
+    return n;
+}
+
+/**
+ * Make the call on top of the stack in tail position. Calls to if and
+ * eval have the expression they pick evaluated up to its own call,
+ * which is left on the stack for the caller to make in turn: returns 1
+ * with its length in n. Otherwise returns 0 with the result in r.
+ */
+static int tail_expr(LFRAME* fr, int* n, LVAL** r) {
+    LVAL* f = stack[sp - *n];
+    LBUILTIN b = ltype(f) == LVAL_FUN ? f->builtin : NULL;
+    if (b != builtin_if && b != builtin_eval) {
+        *r = call(fr, *n);
+        return 0;
+    }
+    for (int i = 1; i < *n; i++) {
+        if (ltype(stack[sp - i]) == LVAL_ERR) {
+            *r = call(fr, *n);
+            return 0;
+        }
+    }
+
+    LVAL* a = lval_sexpr();
+    lval_reserve(a, *n - 1);
+    a->count = *n - 1;
+    memcpy(a->cell, &stack[sp - a->count], sizeof(LVAL*) * a->count);
+    sp -= *n;
+
+    LENV* e = frame_env(fr);
+    LVAL* x = b == builtin_if ? builtin_if_expr(e, a) : builtin_eval_expr(e, a);
+    lval_del(f);
+
+    while (ltype(x) == LVAL_SEXPR && x->count == 1) { x = lval_take(x, 0); }
+    if (ltype(x) != LVAL_SEXPR || x->count == 0) {
+        *r = lval_eval(e, x);
+        return 0;
+    }
+
+    *n = x->count;
+    for (int i = 0; i < *n; i++) {
+        LVAL* v = lval_eval(e, lval_ref(x->cell[i]));
+        reserve(1);
+        stack[sp++] = v;
+    }
+    lval_del(x);
+    return 1;
+}
+
+/**
+ * Run code in a new frame, taking over a reference to the code. The
+ * frame is either an env, or slots from base to the top of the stack.
+ * Tail calls to other compiled lambdas reuse the frame's place.
+ */
+static LVAL* run(LCODE* c, long base, LENV* env, LFRAME* up, LENV* parent) {
+    LFRAME fr = { c, base, env, up, parent };
+    if (!env) { bind_slots(c); }
+
+    /* Finished frames a tail callee may still look into */
+    LENV** held = NULL;
+    int nheld = 0;
+
+    int* code = c->code;
+    int pc = 0;
+    int n;
+    LVAL* r;
+
+    if (leval_max_depth && depth >= leval_max_depth) {
+        r = leval_too_deep();
+        goto done;
+    }
+    depth++;
+    reserve(c->maxstack);
+    if (c->tree) { goto tree; }
+
+    while (1) {
+        switch (code[pc++]) {
+        case OP_CONST:
+            stack[sp++] = lval_ref(c->consts[code[pc++]]);
+            break;
+
+        case OP_LOCAL:
+            stack[sp++] = lval_ref(operand_val(&fr, code[pc++]));
+            break;
+
+        case OP_LOOKUP:
+            stack[sp++] = lookup(&fr, c->consts[code[pc++]]);
+            break;
+
+        case OP_JUMP:
+            pc = code[pc];
+            break;
+
+        case OP_IF: {
+            LGUARD* g = &c->guards[code[pc]];
+            LVAL* cond = stack[sp - 1];
+
+            if (ltype(cond) == LVAL_NUM && guard_holds(&fr, g)) {
+                int taken = lnum(cond) != 0;
+                lval_del(cond);
+                sp--;
+                pc = taken ? pc + 5 : code[pc + 3];
+                break;
+            }
+
+            /* Errors, wrong types and a rebound if go through a call */
+            LVAL* args[3] = { cond, lval_ref(c->consts[code[pc + 1]]),
+                              lval_ref(c->consts[code[pc + 2]]) };
+            sp--;
+            LVAL* x = slow_call(&fr, g, args, 3);
+            stack[sp++] = x;
+            pc = code[pc + 4];
+            break;
+        }
+
+        case OP_ARITH: {
+            int op = code[pc];
+            LGUARD* g = &c->guards[code[pc + 1]];
+            pc += 2;
+
+            LVAL* x = stack[sp - 2];
+            LVAL* y = stack[sp - 1];
+            int ok = lval_is_fixnum(x) && lval_is_fixnum(y) && guard_holds(&fr, g);
+            LVAL* v = ok ? arith_op(op, lnum(x), lnum(y), &ok) : NULL;
+
+            sp -= 2;
+            if (!ok) {
+                LVAL* args[2] = { x, y };
+                v = slow_call(&fr, g, args, 2);
+            }
+            stack[sp++] = v;
+            break;
+        }
+
+        case OP_ARITH_RK: {
+            int op = code[pc];
+            LGUARD* g = &c->guards[code[pc + 1]];
+            LVAL* x = operand_val(&fr, code[pc + 2]);
+            LVAL* y = operand_val(&fr, code[pc + 3]);
+            pc += 4;
+
+            int ok = lval_is_fixnum(x) && lval_is_fixnum(y) && guard_holds(&fr, g);
+            LVAL* v = ok ? arith_op(op, lnum(x), lnum(y), &ok) : NULL;
+
+            if (!ok) {
+                LVAL* args[2] = { lval_ref(x), lval_ref(y) };
+                v = slow_call(&fr, g, args, 2);
+            }
+            stack[sp++] = v;
+            break;
+        }
+
+        case OP_CALL: {
+            int n = code[pc++];
+            LVAL* x = call(&fr, n);
+            stack[sp++] = x;
+            break;
+        }
+
+        case OP_TAILCALL:
+            n = code[pc++];
+        tailcall: {
+            long s = sp - n;
+            LVAL* f = stack[s];
+            LCODE* next = ltype(f) == LVAL_FUN ? fast_code(f, &fr, n - 1) : NULL;
+            for (int i = 1; i < n && next; i++) {
+                if (ltype(stack[s + i]) == LVAL_ERR) { next = NULL; }
+            }
+            if (!next && tail_expr(&fr, &n, &r)) { goto tailcall; }
+            if (!next) { goto finish; }
+
+            /* The finished frame can go if the callee hides all of it */
+            if (frame_shadowed(&fr, next)) {
+                if (fr.env) {
+                    up = NULL;
+                    parent = fr.env->parent;
+                    lenv_del(fr.env);
+                } else {
+                    up = fr.up;
+                    parent = fr.parent;
+                    unbind_slots(c);
+                }
+            } else {
+                held = realloc(held, sizeof(LENV*) * (nheld + 1));
+                held[nheld++] = frame_env(&fr);
+                up = NULL;
+                parent = fr.env;
+            }
+
+            /* Slide the call down over the old slots */
+            for (long i = base; i < s; i++) { drop(stack[i]); }
+            memmove(&stack[base], &stack[s], sizeof(LVAL*) * n);
+            enter_slots(base, f, n);
+
+            next->refs++;
+            lval_del(f);
+            lvm_release(c);
+
+            c = next;
+            fr = (LFRAME){ c, base, NULL, up, parent };
+            bind_slots(c);
+            if (c->tree) { goto tree; }
+            code = c->code;
+            pc = 0;
+            reserve(c->maxstack);
+            break;
+        }
+
+        case OP_RET:
+            r = stack[--sp];
+            goto finish;
+        }
+    }
+
+tree:
+    r = c->tree->fn(c->tree, &fr);
+    if (r == &tail_mark) {
+        n = tail_n;
+        goto tailcall;
+    }
+
+finish:
+    depth--;
+done:
+    while (sp > base) { drop(stack[--sp]); }
+
+    if (fr.env) { lenv_del(fr.env); }
+    else { unbind_slots(c); }
+    while (nheld) { lenv_del(held[--nheld]); }
+    if (held) { free(held); }
+    lvm_release(c);
+    return r;
+}
+
+/**
+ * Call a lambda with an argument list, running its body as bytecode
+ * if it compiles, and by walking it otherwise.
+ */
+LVAL* lvm_apply(LENV* e, LVAL* f, LVAL* a) {
+    LCODE* c = lvm_code(f, e);
+    if (!c) { return lval_call(e, f, a); }
+
+    if (c->simple && a->count == f->formals->count) {
+        long base = sp;
+        a = lval_own(a);
+        reserve(f->env->count + a->count);
+        for (int i = 0; i < f->env->count; i++) {
+            stack[sp++] = lval_ref(f->env->vals[i]);
+        }
+        for (int i = 0; i < a->count; i++) {
+            stack[sp++] = a->cell[i];
+            a->cell[i] = lval_fixnum(0);
+        }
+        lval_del(a);
+        c->refs++;
+        lval_del(f);
+        return run(c, base, NULL, NULL, e);
+    }
+
+    f = lval_bind(e, f, a);
+    if (ltype(f) == LVAL_ERR || f->formals->count) { return f; }
+
+    LENV* frame = f->env;
+    f->env = lenv_new();
+    frame->parent = e;
+    c = f->code;
+    c->refs++;
+    lval_del(f);
+    return run(c, sp, frame, NULL, e);
+}
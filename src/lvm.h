@@ -0,0 +1,37 @@
+#ifndef lvm_h
+#define lvm_h
+
+#include "lval.h"
+
+/* Builtin a specialised instruction stands for, and when that was seen */
+typedef struct {
+    LVAL* sym;
+    LBUILTIN builtin;
+    unsigned version;
+} LGUARD;
+
+/* Bytecode for a lambda body, shared by all copies of the lambda */
+typedef struct LCODE {
+    int refs;
+    int ok;             /* 0 if the body couldn't be compiled */
+    int simple;         /* formals are plain, no '&' */
+    int nslots;         /* formals, bound or not */
+    char** names;       /* of the slots */
+
+    int* code;
+    int ncode;
+    LVAL** consts;
+    int nconsts;
+    LGUARD* guards;
+    int nguards;
+    int maxstack;
+
+    struct LNODE* tree; /* closure tree instead of code */
+} LCODE;
+
+LCODE* lvm_code(LVAL* f, struct LENV* e);
+void   lvm_release(LCODE* c);
+LVAL*  lvm_apply(struct LENV* e, LVAL* f, LVAL* a);
+void   lvm_cleanup(void);
+
+#endif
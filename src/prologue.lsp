@@ -45,7 +45,7 @@
 (defn {even? x} { not (odd? x) })
 
 (defn {num? x} {
-  eq "number" (type x)
+  or (eq "number" (type x)) (eq "float" (type x))
 })
 
 (defn {str? x} {
@@ -53,7 +53,7 @@
 })
 
 (defn {list? x} {
-  in? {"sexpr" "qexpr"} (type x)
+  or (eq "sexpr" (type x)) (eq "qexpr" (type x))
 })
 
 ;; logical ops
@@ -85,35 +85,7 @@
 (defn {first l}  { eval (head l)} )
 (defn {second l} { eval (head (tail l)) })
 
-(defn {nth n l} {
-  if (zero? n)
-    {first l}
-    {nth (dec n) (tail l)}
-})
-
-(defn {last l} { nth (dec (len l)) l })
-
-(defn {but-last l} {
-  if (empty? (tail l))
-    {nil}
-    {join (head l) (but-last (tail l))}
-})
-
-(defn {take n l} {
-  if (and n (len l))
-    {join (head l) (take (dec n) (tail l))}
-    {nil}
-})
-
-(defn {drop n l} {
-  if (and n (len l))
-    {drop (dec n) (tail l)}
-    {l}
-})
-
-(defn {split n l} {
-  list (take n l) (drop n l)
-})
+(defn {but-last l} { take (dec (len l)) l })
 
 (defn {in? l x} {
   if (empty? l)
@@ -123,12 +95,6 @@
       {in? (tail l) x}}
 })
 
-(defn {reverse l} {
-  if (empty? l)
-    {nil}
-    {join (reverse (tail l)) (head l)}
-})
-
 (defn {flatten l} {
   if (empty? l)
     {nil}
@@ -214,12 +180,6 @@
     {drop-while f (tail l)}
 })
 
-(defn {zip x y} {
-  if (any? empty? {x y})
-    {nil}
-    {join (list (join (head x) (head y))) (zip (tail x) (tail y))}
-})
-
 (defn {comp & fs} {
   (fn {fs args} {
     foldr (fn {z g} {z g}) ((last fs) args) (but-last fs)
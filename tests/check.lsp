@@ -0,0 +1,8 @@
+; Helpers for the regression scripts; tests/run.sh loads this first
+
+; Print whether an expression came out as expected
+(defn {expect name got want} {
+  if (== got want)
+    {print "ok" name}
+    {print "FAIL" name got want}
+})
@@ -0,0 +1,3 @@
+; Loaded from inside a function by test-load.lsp
+(= {y} (list 7 z))
+(= {w} (join y (map (-> {x} {* x 2}) y)))
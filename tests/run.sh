@@ -0,0 +1,39 @@
+#!/bin/sh
+# Run each tests/test-*.lsp on every engine. A script passes when the
+# interpreter exits cleanly and what it prints is either free of FAIL
+# and errors or, if there is a test-*.out next to it, exactly that;
+# the latter is how scripts pin down the errors they expect.
+# Run from src/, where the interpreter finds its prologue.
+
+LISPY=${LISPY:-./lispy}
+status=0
+
+for t in ../tests/test-*.lsp; do
+    expected=${t%.lsp}.out
+    for engine in tree stack vm closure; do
+        out=$(printf 'load "../tests/check.lsp"\nload "%s"\n' "$t" |
+              "$LISPY" --engine=$engine 2>&1)
+        code=$?
+        printed=$(echo "$out" | grep -v '^>>\|^=> \|^Ta-ta\|^$')
+
+        if [ -f "$expected" ]; then
+            echo "$printed" | diff "$expected" - > /dev/null
+        else
+            ! echo "$printed" | grep -q 'FAIL\|Error'
+        fi
+
+        if [ $? -ne 0 ] || [ $code -ne 0 ]; then
+            echo "$t ($engine): failed"
+            if [ -f "$expected" ]; then
+                echo "$printed" | diff "$expected" -
+            else
+                echo "$printed" | grep 'FAIL\|Error'
+            fi
+            status=1
+        else
+            echo "$t ($engine): ok"
+        fi
+    done
+done
+
+exit $status
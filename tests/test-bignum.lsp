@@ -0,0 +1,51 @@
+; Integers past a machine word: promotion on overflow, demotion once a
+; result fits again, and division that truncates like C's
+
+(def {max} 9223372036854775807)
+(def {min} -9223372036854775808)
+
+(expect "+ overflows" (+ max 1) 9223372036854775808)
+(expect "- overflows" (- min 1) -9223372036854775809)
+(expect "* overflows" (* max 2) 18446744073709551614)
+(expect "negating min" (- 0 min) 9223372036854775808)
+(expect "* -1 of min" (* -1 min) 9223372036854775808)
+(expect "/ -1 of min" (/ min -1) 9223372036854775808)
+(expect "% -1 of min" (% min -1) 0)
+(expect "2^64" (* 4294967296 4294967296) 18446744073709551616)
+
+; The same inside functions, which the vm and closure engines compile
+(defn {add a b} { + a b })
+(defn {sub a b} { - a b })
+(defn {mul a b} { * a b })
+(expect "compiled + overflows" (add max 1) 9223372036854775808)
+(expect "compiled - overflows" (sub min 1) -9223372036854775809)
+(expect "compiled * overflows" (mul max max) 85070591730234615847396907784232501249)
+(expect "compiled - comes back" (sub (add max 1) 1) max)
+
+; vec only takes word-sized integers, so it tells whether one has come back
+(defn {fits? n} { == (vlen (vec (list n))) 1 })
+(expect "back to a word" (fits? (- (+ max 1) 1)) 1)
+(expect "difference fits" (fits? (- 18446744073709551616 18446744073709551615)) 1)
+(expect "quotient fits" (fits? (/ 100000000000000000000000 100000000000000000000000)) 1)
+
+(expect "reads big literals" (- 123456789012345678901234567890 123456789012345678901234567889) 1)
+(expect "reads big negatives" (+ -123456789012345678901234567890 123456789012345678901234567890) 0)
+
+(expect "/ truncates" (list (/ -7 2) (/ 7 -2)) {-3 -3})
+(expect "% keeps the dividend sign" (list (% -7 2) (% 7 -2)) {-1 1})
+(expect "big / truncates" (/ -100000000000000000000001 2) -50000000000000000000000)
+(expect "big % keeps the dividend sign" (% -100000000000000000000001 2) -1)
+
+(expect "big >" (> 100000000000000000000000 99999999999999999999999) 1)
+(expect "big <" (< -100000000000000000000000 min) 1)
+
+; Big enough operands for Karatsuba's method
+(defn {fact n acc} { if (== n 0) {acc} {fact (dec n) (* acc n)} })
+(def {f} (fact 500 1))
+(expect "square over itself" (/ (* f f) f) f)
+(expect "(f+1)^2 - f^2" (- (* (+ f 1) (+ f 1)) (* f f)) (+ (* 2 f) 1))
+(expect "factorial over factorial" (/ (fact 300 1) (fact 299 1)) 300)
+
+(/ 1 0)
+(% 1 0)
+(/ 100000000000000000000000 0)
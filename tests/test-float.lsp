@@ -0,0 +1,38 @@
+; Floats: reading them, printing them as the shortest text that reads
+; back the same, mixing them with integers, and comparing the two
+
+(expect "a float" (type 1.5) "float")
+(expect "exponents" (list 2.5E-3 1e2) {0.0025 100.0})
+(expect "printed text reads back" (+ 0.1 0.2) 0.30000000000000004)
+(expect "third reads back" (/ 1.0 3) 0.3333333333333333)
+
+(expect "int + float" (+ 1 0.5) 1.5)
+(expect "int * float" (* 2 1.5) 3.0)
+(expect "int / float" (/ 1 2.0) 0.5)
+(expect "int / int stays whole" (/ 1 2) 0)
+(expect "float % int" (% 7.5 2) 1.5)
+(expect "mixed is a float" (type (+ 1 0.5)) "float")
+(expect "big + float" (type (+ 99999999999999999999999 1.0)) "float")
+(expect "divide by zero" (list (/ 1.0 0) (/ -1.0 0)) (list (/ 2.0 0) (/ -2.0 0)))
+(expect "mixed order" (list (> 1 0.5) (< 2.5 3) (>= 2 2.0)) {1 1 1})
+
+; Equal only when the float is exactly the integer's value
+(expect "1 and 1.0" (== 1 1.0) 1)
+(expect "1 and 1.5" (== 1 1.5) 0)
+(expect "0 and -0.0" (== 0 -0.0) 1)
+(expect "past 2^53" (== 9007199254740993 9007199254740992.0) 0)
+(expect "at 2^53" (== 9007199254740992 9007199254740992.0) 1)
+(expect "1e23 is not 10^23" (== 100000000000000000000000 1e23) 0)
+(expect "1e23 is itself" (== 99999999999999991611392 1e23) 1)
+(expect "not infinity" (== 1 (/ 1.0 0)) 0)
+(expect "in lists too" (== {1 {2}} {1.0 {2.0}}) 1)
+(expect "!=" (!= 1 1.0) 0)
+
+; floor leaves integers as they are
+(expect "floor of a float" (floor -2.5) -3.0)
+(expect "floor of an integer" (type (floor 3)) "number")
+(expect "floor of a bignum" (floor 99999999999999999999999) 99999999999999999999999)
+(expect "floor of a list" (floor {1 2.5 99999999999999999999999}) {1 2.0 99999999999999999999999})
+
+(print 0.1 (+ 0.1 0.2) 1e23 1.0 -0.0 (/ 1.0 3) 1e-7 123456789.125)
+(print 1.5e300 2.5E-3 100.0 1e16 1e15 (/ 1.0 0) (/ -1.0 0))
@@ -0,0 +1,19 @@
+; Folding a lambda body mustn't change what calling it returns
+
+(expect "if picks a quoted list" ((-> {x} {if 1 {{1 2}} {3}}) 0) {1 2})
+(expect "if picks a list of symbols" ((-> {x} {if (< 1 2) {{a b}} {3}}) 0) {a b})
+(expect "if picks an expression" ((-> {x} {if (> 1 2) {3} {(+ 1 x)}}) 4) 5)
+(expect "folded branch stays a body" (optimized-body (-> {x} {if 1 {{1 2}} {3}})) {{1 2}})
+
+; Calls replaced by the body of what they call
+(defn {quoted x} {{1 2}})
+(defn {calls-quoted y} {quoted 5})
+(expect "inlined body is a quoted list" (calls-quoted 0) {1 2})
+
+(defn {one-expr x} {(+ x 1)})
+(defn {calls-one-expr y} {one-expr 5})
+(expect "inlined body is one expression" (calls-one-expr 0) 6)
+
+(def {five} (-> {} {5}))
+(defn {names-five y} {list (five) 1})
+(expect "(f) is f, not a call" (first (names-five 0)) five)
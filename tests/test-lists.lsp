@@ -0,0 +1,25 @@
+; Taking a list apart: counts past either end are clamped, and an
+; index past either end is an error
+
+(expect "take -1" (take -1 {1 2}) {})
+(expect "drop -1" (drop -1 {1 2}) {1 2})
+(expect "take past the end" (take 5 {1 2}) {1 2})
+(expect "drop past the end" (drop 5 {1 2}) {})
+(expect "take from nothing" (take 1 {}) {})
+(expect "split -1" (split -1 {1 2}) {{} {1 2}})
+(expect "split past the end" (split 5 {1 2}) {{1 2} {}})
+(expect "split" (split 1 {1 2 3}) {{1} {2 3}})
+
+(expect "but-last" (but-last {1 2 3}) {1 2})
+(expect "but-last of one" (but-last {1}) {})
+(expect "but-last of nothing" (but-last {}) {})
+
+(expect "nth" (nth 1 {1 2}) 2)
+(expect "nth evaluates" (nth 0 {{1 2}}) {1 2})
+(expect "last" (last {1 2 3}) 3)
+(expect "last evaluates" (last {(+ 1 2)}) 3)
+
+(nth 2 {1 2})
+(nth -1 {1 2})
+(nth 0 {})
+(last {})
@@ -0,0 +1,8 @@
+; Loading a file from inside a function binds into the caller's frame
+
+(defn {nested-load z} {do (load "../tests/load-y.lsp") (gc ()) (list y w)})
+(expect "nested load" (nested-load 3) {{7 3} {7 3 14 6}})
+(expect "nested load again" (map nested-load {1 2}) {{{7 1} {7 1 14 2}} {{7 2} {7 2 14 4}}})
+
+(defn {sees-args z} {do (load "../tests/load-y.lsp") z})
+(expect "args survive nested load" (sees-args 5) 5)